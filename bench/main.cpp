@@ -0,0 +1,417 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Headless benchmarks for the storage and canvas hot paths. Prints one JSON
+// object with a result per operation and document size, see --help
+
+#include "logger.hpp"
+#include "storage.hpp"
+#include "stroke_codec.hpp"
+#include "ui/canvas.hpp"
+#include "ui/loader.hpp"
+
+#include <qapplication.h>
+#include <qcommandlineparser.h>
+#include <qevent.h>
+#include <qfile.h>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+using namespace sketchy;
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+constexpr std::uint64_t default_seed = 0x5ce7c4;
+/// Input events timed per size for drawing and erasing
+constexpr std::size_t draw_events = 2000;
+constexpr std::size_t erase_events = 500;
+/// Bulk operations are repeated until about this many points have gone
+/// through, within [1, max_runs]
+constexpr std::size_t points_per_op = 2'000'000;
+constexpr std::size_t max_runs = 20;
+
+/// Peak resident set of the whole process so far, in KiB
+auto peak_rss_kb() -> long
+{
+#if defined(__unix__) || defined(__APPLE__)
+    rusage u{};
+    getrusage(RUSAGE_SELF, &u);
+#ifdef __APPLE__
+    return u.ru_maxrss / 1024;
+#else
+    return u.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/// Lines of cursive-ish words: each word is one stroke wobbling along the
+/// baseline with smoothly varying pressure, like a pen moving at a few
+/// hundred reports a second
+auto generate(std::size_t points, std::uint64_t seed)
+    -> std::vector<detail::stroke>
+{
+    constexpr auto page_width = 2000.0;
+    constexpr auto line_height = 48.0;
+    std::mt19937_64 rng{seed};
+    std::uniform_int_distribution<std::size_t> word_len{20, 200};
+    std::uniform_real_distribution<double> unit{0, 1};
+    const std::array colours{QColor{Qt::black}, QColor{Qt::black},
+                             QColor{Qt::black}, QColor{"#1c4fbf"},
+                             QColor{"#c0392b"}};
+
+    std::vector<detail::stroke> out;
+    QPointF cursor{20, line_height};
+    std::size_t made = 0;
+    while (made < points) {
+        const auto n = std::min(word_len(rng), points - made);
+        auto& s = out.emplace_back(colours[rng() % colours.size()]);
+        s.points.reserve(n);
+        const auto freq = 0.3 + unit(rng) * 0.4;
+        const auto height = 6.0 + unit(rng) * 8.0;
+        const auto phase = unit(rng) * 2 * std::numbers::pi;
+        for (std::size_t i = 0; i != n; ++i) {
+            const auto t = static_cast<double>(i);
+            const auto jitter = (unit(rng) - 0.5) * 0.2;
+            s.append(detail::stroke::point{
+                {cursor.x() + t * 0.6 + jitter,
+                 cursor.y() - height * std::sin(t * freq + phase)},
+                static_cast<float>(1.5 + std::sin(t * 0.05 + phase))});
+        }
+        made += n;
+        cursor.rx() += static_cast<double>(n) * 0.6 + 12;
+        if (cursor.x() > page_width) {
+            cursor = {20, cursor.y() + line_height};
+        }
+    }
+    return out;
+}
+
+auto count_points(const std::vector<detail::stroke>& doc) -> std::size_t
+{
+    std::size_t n = 0;
+    for (const auto& s : doc) {
+        n += s.points.size();
+    }
+    return n;
+}
+
+struct result {
+    std::string op;
+    std::size_t points;
+    std::size_t strokes;
+    /// What throughput counts: points for bulk operations, events for input
+    std::string unit;
+    std::size_t per_run;
+    std::vector<double> secs;
+    long peak_rss_kb;
+};
+
+auto percentile(const std::vector<double>& sorted, double p) -> double
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const auto rank = static_cast<std::size_t>(
+        std::ceil(p / 100 * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+auto to_json(const result& r) -> std::string
+{
+    auto secs = r.secs;
+    std::sort(secs.begin(), secs.end());
+    const auto p50 = percentile(secs, 50);
+    const auto us = [](double s) { return s * 1e6; };
+    return fmt::format(
+        R"({{"op": "{}", "points": {}, "strokes": {}, "runs": {}, )"
+        R"("unit": "{}", "throughput": {:.1f}, "p50_us": {:.3f}, )"
+        R"("p90_us": {:.3f}, "p99_us": {:.3f}, "max_us": {:.3f}, )"
+        R"("peak_rss_kb": {}}})",
+        r.op, r.points, r.strokes, secs.size(), r.unit,
+        p50 > 0 ? static_cast<double>(r.per_run) / p50 : 0.0, us(p50),
+        us(percentile(secs, 90)), us(percentile(secs, 99)),
+        us(secs.empty() ? 0 : secs.back()), r.peak_rss_kb);
+}
+
+template<typename F>
+auto elapsed(F&& f) -> double
+{
+    const auto start = clock_type::now();
+    f();
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+class bench {
+public:
+    bench(std::uint64_t seed, const QStringList& only)
+        : seed_{seed}, only_{only}
+    {
+    }
+
+    void run(std::size_t points)
+    {
+        const auto doc = generate(points, seed_ + points);
+        points_ = count_points(doc);
+        strokes_ = doc.size();
+        runs_ = std::clamp<std::size_t>(points_per_op / points_, 1, max_runs);
+
+        std::string json;
+        bulk("to_json", [&] { json = sketchy::to_json(doc); });
+        bulk("from_json", [&] { (void)from_json(json); });
+        json = {};
+        std::string bin;
+        bulk("to_binary", [&] { bin = to_binary(doc); });
+        bulk("from_binary", [&] { (void)from_binary(bin); });
+        bin = {};
+        std::string enc;
+        bulk("encode_strokes", [&] { enc = encode_strokes(doc); });
+        bulk("decode_strokes", [&] { (void)decode_strokes(enc); });
+        enc = {};
+
+        ui::canvas c{logging::get(logging::canvas)};
+        c.resize(1280, 800);
+        c.show();
+        stream_load(c, doc);
+        bulk("canvas_set_strokes", [&] { c.set_strokes(doc); });
+        if (!wanted("canvas_set_strokes")) {
+            c.set_strokes(doc);
+        }
+        QApplication::processEvents();
+        bulk("canvas_strokes", [&] { (void)c.strokes(); });
+        draw(c);
+        erase(c, doc);
+    }
+
+    auto results() const -> const std::vector<result>& { return results_; }
+
+private:
+    auto wanted(const char* op) const -> bool
+    {
+        return only_.isEmpty() || only_.contains(QString{op});
+    }
+
+    template<typename F>
+    void bulk(const char* op, F&& f)
+    {
+        if (!wanted(op)) {
+            return;
+        }
+        result r{op, points_, strokes_, "points", points_, {}, 0};
+        for (std::size_t i = 0; i != runs_; ++i) {
+            r.secs.push_back(elapsed(f));
+        }
+        r.peak_rss_kb = peak_rss_kb();
+        results_.push_back(std::move(r));
+    }
+
+    /// Load the way a document streams in from the loader: nearest the
+    /// view first, in batches of about load_batch_points
+    void stream_load(ui::canvas& c, const std::vector<detail::stroke>& doc)
+    {
+        if (!wanted("canvas_add_loaded")) {
+            return;
+        }
+        std::vector<stored_stroke> stored;
+        stored.reserve(doc.size());
+        for (const auto& s : doc) {
+            stored.push_back({stored.size(), s});
+        }
+        ui::detail::nearest_first(stored, QRectF{0, 0, 1280, 800});
+        std::vector<std::vector<stored_stroke>> batches(1);
+        std::size_t in_batch = 0;
+        for (auto& s : stored) {
+            if (in_batch >= ui::load_batch_points) {
+                batches.emplace_back();
+                in_batch = 0;
+            }
+            in_batch += s.data.points.size();
+            batches.back().push_back(std::move(s));
+        }
+        bulk("canvas_add_loaded", [&] {
+            c.begin_load();
+            for (const auto& b : batches) {
+                c.add_loaded(b, doc.size());
+            }
+            c.end_load();
+        });
+    }
+
+    /// Mouse event at a scene position the way the window system would
+    /// send it to the view. Made before any timing starts, so only handing
+    /// it over is timed
+    static auto mouse_event(const ui::canvas_view& view, QEvent::Type type,
+                            const QPointF& scene, Qt::MouseButtons buttons)
+        -> QMouseEvent
+    {
+        const auto at = QPointF{view.mapFromScene(scene)};
+        const auto button = type == QEvent::MouseMove ? Qt::NoButton
+                                                      : Qt::LeftButton;
+        return QMouseEvent{type,   at,      view.mapToGlobal(at),
+                           button, buttons, Qt::NoModifier};
+    }
+    static void send(ui::canvas_view* view, QEvent::Type type,
+                     const QPointF& scene, Qt::MouseButtons buttons)
+    {
+        auto ev = mouse_event(*view, type, scene, buttons);
+        QApplication::sendEvent(view, &ev);
+    }
+
+    /// Latency of each pen move while drawing short strokes over the page.
+    /// Moves are queued until the next frame, so each is flushed into the
+    /// stroke straight away to time building it too
+    void draw(ui::canvas& c)
+    {
+        if (!wanted("add_stroke")) {
+            return;
+        }
+        c.curr_mode(ui::canvas::mode::draw);
+        auto* view = c.findChild<ui::canvas_view*>();
+        std::mt19937_64 rng{seed_};
+        std::uniform_real_distribution<double> pos{0, 1000};
+        result r{"add_stroke", points_, strokes_, "events", 1, {}, 0};
+        r.secs.reserve(draw_events);
+        constexpr std::size_t per_stroke = 100;
+        for (std::size_t i = 0; i < draw_events; i += per_stroke) {
+            QPointF at{pos(rng), pos(rng)};
+            send(view, QEvent::MouseButtonPress, at, Qt::LeftButton);
+            for (std::size_t j = 0; j != per_stroke; ++j) {
+                at += QPointF{0.7, std::sin(static_cast<double>(j) * 0.4)};
+                auto ev =
+                    mouse_event(*view, QEvent::MouseMove, at, Qt::LeftButton);
+                r.secs.push_back(elapsed([&] {
+                    QApplication::sendEvent(view, &ev);
+                    c.flush_samples();
+                }));
+            }
+            send(view, QEvent::MouseButtonRelease, at, Qt::NoButton);
+            QApplication::processEvents();
+        }
+        r.peak_rss_kb = peak_rss_kb();
+        results_.push_back(std::move(r));
+    }
+
+    /// Latency of each eraser move, aimed at points of the document
+    void erase(ui::canvas& c, const std::vector<detail::stroke>& doc)
+    {
+        if (!wanted("handle_erase") || doc.empty()) {
+            return;
+        }
+        c.curr_mode(ui::canvas::mode::erase);
+        auto* view = c.findChild<ui::canvas_view*>();
+        std::mt19937_64 rng{seed_};
+        result r{"handle_erase", points_, strokes_, "events", 1, {}, 0};
+        r.secs.reserve(erase_events);
+        send(view, QEvent::MouseButtonPress, doc.front().points.front().pos,
+             Qt::LeftButton);
+        for (std::size_t i = 0; i != erase_events; ++i) {
+            const auto& s = doc[rng() % doc.size()];
+            const auto at = s.points[rng() % s.points.size()].pos;
+            auto ev =
+                mouse_event(*view, QEvent::MouseMove, at, Qt::LeftButton);
+            r.secs.push_back(
+                elapsed([&] { QApplication::sendEvent(view, &ev); }));
+        }
+        send(view, QEvent::MouseButtonRelease,
+             doc.front().points.front().pos, Qt::NoButton);
+        QApplication::processEvents();
+        r.peak_rss_kb = peak_rss_kb();
+        results_.push_back(std::move(r));
+    }
+
+    std::uint64_t seed_;
+    QStringList only_;
+    std::size_t points_{0};
+    std::size_t strokes_{0};
+    std::size_t runs_{1};
+    std::vector<result> results_;
+};
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app{argc, argv};
+
+    QCommandLineParser args;
+    args.setApplicationDescription(
+        "Times storage and canvas operations on generated handwriting and "
+        "prints the results as JSON");
+    args.addHelpOption();
+    const QCommandLineOption sizes_opt{
+        "sizes", "Comma separated document sizes in points.", "points",
+        "1000,10000,100000,1000000,10000000"};
+    const QCommandLineOption seed_opt{"seed", "Generator seed.", "seed",
+                                      QString::number(default_seed)};
+    const QCommandLineOption ops_opt{
+        "ops", "Comma separated operations to run, default all.", "ops"};
+    const QCommandLineOption out_opt{"out", "Write to a file, not stdout.",
+                                     "path"};
+    args.addOptions({sizes_opt, seed_opt, ops_opt, out_opt});
+    args.process(app);
+
+    logging::init("warn");
+    bench b{args.value(seed_opt).toULongLong(),
+            args.isSet(ops_opt) ? args.value(ops_opt).split(',')
+                                : QStringList{}};
+    for (const auto& size : args.value(sizes_opt).split(',')) {
+        if (const auto n = size.toULongLong(); n > 0) {
+            b.run(n);
+        }
+    }
+
+    std::string out = fmt::format(R"({{"seed": {}, "results": [)",
+                                  args.value(seed_opt).toULongLong());
+    const auto& results = b.results();
+    for (std::size_t i = 0; i != results.size(); ++i) {
+        out += fmt::format("{}\n  {}", i == 0 ? "" : ",", to_json(results[i]));
+    }
+    out += "\n]}\n";
+
+    if (args.isSet(out_opt)) {
+        QFile f{args.value(out_opt)};
+        if (!f.open(QFile::WriteOnly)) {
+            fmt::print(stderr, "failed to open {}\n",
+                       args.value(out_opt).toStdString());
+            return 1;
+        }
+        f.write(out.data(), static_cast<qint64>(out.size()));
+    }
+    else {
+        fmt::print("{}", out);
+    }
+    logging::shutdown();
+    return 0;
+}
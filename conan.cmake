@@ -12,7 +12,7 @@ endif()
 include(${CMAKE_BINARY_DIR}/conan.cmake)
 
 
-set(CONAN_DEPS spdlog/1.9.2)
+set(CONAN_DEPS spdlog/1.9.2 zlib/1.2.11)
 if (SKETCHY_BUILD_TESTS) 
   list(APPEND CONAN_DEPS doctest/2.4.6)
 endif()
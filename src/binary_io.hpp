@@ -0,0 +1,112 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "storage.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace sketchy::detail {
+
+constexpr auto pad8(std::size_t n) -> std::size_t { return (n + 7) & ~7; }
+
+template<typename T>
+auto byteswap(T v) -> T
+{
+    auto bytes = std::bit_cast<std::array<std::byte, sizeof(T)>>(v);
+    std::reverse(bytes.begin(), bytes.end());
+    return std::bit_cast<T>(bytes);
+}
+
+/// Copy count elements of T in little-endian order from src to dst. On
+/// little-endian hosts this is a plain memcpy
+template<typename T>
+void copy_le(const void* src, std::size_t count, void* dst)
+{
+    // Empty vectors may hand over null, which memcpy does not allow
+    if (count == 0) {
+        return;
+    }
+    std::memcpy(dst, src, count * sizeof(T));
+    if constexpr (std::endian::native == std::endian::big) {
+        auto* out = static_cast<T*>(dst);
+        std::transform(out, out + count, out, byteswap<T>);
+    }
+}
+
+/// Appends little-endian values to a string
+class writer {
+public:
+    explicit writer(std::string& out) : out_{out} {}
+
+    template<typename T>
+    void write(const T* vs, std::size_t count)
+    {
+        const auto at = out_.size();
+        out_.resize(at + count * sizeof(T));
+        copy_le<T>(vs, count, out_.data() + at);
+    }
+    template<typename T>
+    void write(const T& v)
+    {
+        write(&v, 1);
+    }
+    void pad() { out_.resize(pad8(out_.size()), '\0'); }
+
+private:
+    std::string& out_;
+};
+
+/// Reads little-endian values from a view, throws bad_document if it runs
+/// off the end
+class reader {
+public:
+    explicit reader(std::string_view in) : in_{in} {}
+
+    template<typename T>
+    void read(T* to, std::size_t count)
+    {
+        const auto n = count * sizeof(T);
+        if (in_.size() - at_ < n) {
+            throw bad_document{"binary document is truncated"};
+        }
+        copy_le<T>(in_.data() + at_, count, to);
+        at_ += n;
+    }
+    template<typename T>
+    auto read() -> T
+    {
+        T v;
+        read(&v, 1);
+        return v;
+    }
+    void pad() { at_ = std::min(pad8(at_), in_.size()); }
+    auto offset() const -> std::size_t { return at_; }
+
+private:
+    std::string_view in_;
+    std::size_t at_{0};
+};
+
+} // namespace sketchy::detail
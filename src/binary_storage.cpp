@@ -0,0 +1,360 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "binary_io.hpp"
+#include "document.hpp"
+#include "storage.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+
+/*
+ * Layout, all little-endian:
+ *
+ *   header       see binary_header below, 32 bytes
+ *   colours      u32[colour_count], 0xAARRGGBB
+ *   strokes      { u32 colour index, u32 point count }[stroke_count]
+ *   padding      to the next multiple of 8
+ *   xs           f64[point_count]
+ *   ys           f64[point_count]
+ *   weights      f32[point_count]
+ *
+ * Points for every stroke are stored back to back, so the offset of a stroke
+ * is the sum of the point counts before it.
+ *
+ * Strokes with ids (journal records, notebook tiles) are prefixed with:
+ *
+ *   u64          stroke count, top bit set if orders follow the ids
+ *   ids          u64[stroke count]
+ *   orders       u64[stroke count], see stored_stroke::order()
+ */
+
+namespace sketchy {
+using detail::pad8;
+using detail::reader;
+using detail::writer;
+
+namespace {
+constexpr std::array<char, 8> binary_magic{'S', 'K', 'E', 'T',
+                                           'C', 'H', 'Y', '\0'};
+constexpr std::uint32_t binary_version = 1;
+
+struct binary_header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t colour_count;
+    std::uint32_t stroke_count;
+    std::uint32_t reserved;
+    std::uint64_t point_count;
+};
+static_assert(sizeof(binary_header) == 32);
+
+struct binary_stroke {
+    std::uint32_t colour;
+    std::uint32_t points;
+};
+static_assert(sizeof(binary_stroke) == 8);
+
+/// Set in the stroke count of strokes with ids when orders follow them
+constexpr std::uint64_t has_orders = std::uint64_t{1} << 63;
+
+} // namespace
+
+auto is_binary(std::string_view data) -> bool
+{
+    return data.size() >= binary_magic.size() &&
+           std::equal(binary_magic.begin(), binary_magic.end(), data.begin());
+}
+
+auto to_binary(const std::vector<detail::stroke>& strokes) -> std::string
+{
+    std::vector<std::uint32_t> colours;
+    std::unordered_map<QRgb, std::uint32_t> colour_idx;
+    std::vector<binary_stroke> table;
+    table.reserve(strokes.size());
+    std::uint64_t point_count = 0;
+    for (const auto& s : strokes) {
+        const auto rgb = s.colour.rgba();
+        auto [it, added] = colour_idx.try_emplace(rgb, colours.size());
+        if (added) {
+            colours.emplace_back(rgb);
+        }
+        table.push_back({it->second,
+                         static_cast<std::uint32_t>(s.points.size())});
+        point_count += s.points.size();
+    }
+
+    std::vector<double> xs;
+    std::vector<double> ys;
+    std::vector<float> ws;
+    xs.reserve(point_count);
+    ys.reserve(point_count);
+    ws.reserve(point_count);
+    for (const auto& s : strokes) {
+        for (const auto& p : s.points) {
+            xs.emplace_back(p.pos.x());
+            ys.emplace_back(p.pos.y());
+            ws.emplace_back(p.weight);
+        }
+    }
+
+    std::string out;
+    out.reserve(sizeof(binary_header) + colours.size() * 4 +
+                table.size() * sizeof(binary_stroke) + 8 + point_count * 20);
+    writer w{out};
+    out.append(binary_magic.data(), binary_magic.size());
+    w.write(binary_version);
+    w.write(static_cast<std::uint32_t>(colours.size()));
+    w.write(static_cast<std::uint32_t>(table.size()));
+    w.write(std::uint32_t{0});
+    w.write(point_count);
+    w.write(colours.data(), colours.size());
+    for (const auto& s : table) {
+        w.write(s.colour);
+        w.write(s.points);
+    }
+    w.pad();
+    w.write(xs.data(), xs.size());
+    w.write(ys.data(), ys.size());
+    w.write(ws.data(), ws.size());
+    return out;
+}
+
+binary_reader::binary_reader(std::string_view data)
+{
+    if (!is_binary(data)) {
+        throw bad_document{"not a binary sketchy document"};
+    }
+    reader r{data.substr(binary_magic.size())};
+    const auto version = r.read<std::uint32_t>();
+    if (version > binary_version) {
+        throw bad_document{"binary document is from a newer version"};
+    }
+    const auto colour_count = r.read<std::uint32_t>();
+    const auto stroke_count = r.read<std::uint32_t>();
+    r.read<std::uint32_t>();
+    const auto point_count = r.read<std::uint64_t>();
+    // Every count comes from the file, so they are checked against what is
+    // left of it before anything is allocated
+    const auto left = data.size() - sizeof(binary_header);
+    const auto tables = std::uint64_t{colour_count} * 4 +
+                        std::uint64_t{stroke_count} * sizeof(binary_stroke);
+    if (tables > left || point_count > (left - tables) / 20) {
+        throw bad_document{"binary document is truncated"};
+    }
+
+    colours_.resize(colour_count);
+    r.read(colours_.data(), colours_.size());
+    table_.resize(std::size_t{stroke_count} * 2);
+    r.read(table_.data(), table_.size());
+    r.pad();
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i != table_.size(); i += 2) {
+        total += table_[i + 1];
+        if (table_[i] >= colours_.size() || total > point_count) {
+            throw bad_document{"binary document has a corrupt stroke table"};
+        }
+    }
+
+    const auto columns = data.substr(binary_magic.size() + r.offset());
+    if (columns.size() / 20 < point_count) {
+        throw bad_document{"binary document is truncated"};
+    }
+    xs_ = columns.substr(0, point_count * 8);
+    ys_ = columns.substr(point_count * 8, point_count * 8);
+    ws_ = columns.substr(point_count * 16, point_count * 4);
+}
+
+auto binary_reader::next() -> detail::stroke
+{
+    const auto colour = table_[next_ * 2];
+    const auto count = table_[next_ * 2 + 1];
+    ++next_;
+    detail::stroke s{QColor::fromRgba(colours_[colour])};
+    s.points.resize(count);
+    for (std::size_t p = 0; p != count; ++p, ++offset_) {
+        double x;
+        double y;
+        float w;
+        detail::copy_le<double>(xs_.data() + offset_ * 8, 1, &x);
+        detail::copy_le<double>(ys_.data() + offset_ * 8, 1, &y);
+        detail::copy_le<float>(ws_.data() + offset_ * 4, 1, &w);
+        s.points[p] = {{x, y}, w};
+    }
+    return s;
+}
+
+auto from_binary(std::string_view data) -> std::vector<detail::stroke>
+{
+    binary_reader r{data};
+    std::vector<detail::stroke> strokes;
+    strokes.reserve(r.size());
+    while (!r.done()) {
+        strokes.emplace_back(r.next());
+    }
+    return strokes;
+}
+
+auto to_binary(const std::vector<stored_stroke>& obj) -> std::string
+{
+    std::string out;
+    writer w{out};
+    const auto cut = std::any_of(obj.begin(), obj.end(),
+                                 [](const auto& s) { return s.cut_from; });
+    w.write(static_cast<std::uint64_t>(obj.size()) | (cut ? has_orders : 0));
+    std::vector<detail::stroke> strokes;
+    strokes.reserve(obj.size());
+    for (const auto& s : obj) {
+        w.write(s.id);
+        strokes.emplace_back(s.data);
+    }
+    if (cut) {
+        for (const auto& s : obj) {
+            w.write(s.order());
+        }
+    }
+    out += to_binary(strokes);
+    return out;
+}
+
+auto to_binary(const document& doc) -> std::string
+{
+    std::string out;
+    writer w{out};
+    auto cut = false;
+    for (std::size_t i = 0; i != doc.size() && !cut; ++i) {
+        cut = doc.order(i) != doc.id(i);
+    }
+    w.write(static_cast<std::uint64_t>(doc.size()) | (cut ? has_orders : 0));
+    std::vector<std::uint32_t> colours;
+    std::unordered_map<QRgb, std::uint32_t> colour_idx;
+    std::vector<binary_stroke> table;
+    table.reserve(doc.size());
+    for (std::size_t i = 0; i != doc.size(); ++i) {
+        const auto s = doc.view(i);
+        w.write(s.id);
+        auto [it, added] = colour_idx.try_emplace(s.colour.rgba(),
+                                                  colours.size());
+        if (added) {
+            colours.emplace_back(s.colour.rgba());
+        }
+        table.push_back({it->second, static_cast<std::uint32_t>(s.size())});
+    }
+    if (cut) {
+        for (std::size_t i = 0; i != doc.size(); ++i) {
+            w.write(doc.order(i));
+        }
+    }
+
+    const std::uint64_t point_count = doc.points();
+    out.reserve(out.size() + sizeof(binary_header) + colours.size() * 4 +
+                table.size() * sizeof(binary_stroke) + 8 + point_count * 20);
+    out.append(binary_magic.data(), binary_magic.size());
+    w.write(binary_version);
+    w.write(static_cast<std::uint32_t>(colours.size()));
+    w.write(static_cast<std::uint32_t>(table.size()));
+    w.write(std::uint32_t{0});
+    w.write(point_count);
+    w.write(colours.data(), colours.size());
+    for (const auto& s : table) {
+        w.write(s.colour);
+        w.write(s.points);
+    }
+    w.pad();
+    // Back to absolute positions a stroke at a time
+    std::vector<double> column;
+    for (std::size_t i = 0; i != doc.size(); ++i) {
+        const auto s = doc.view(i);
+        column.assign(s.xs.begin(), s.xs.end());
+        for (auto& x : column) {
+            x += s.origin.x();
+        }
+        w.write(column.data(), column.size());
+    }
+    for (std::size_t i = 0; i != doc.size(); ++i) {
+        const auto s = doc.view(i);
+        column.assign(s.ys.begin(), s.ys.end());
+        for (auto& y : column) {
+            y += s.origin.y();
+        }
+        w.write(column.data(), column.size());
+    }
+    for (std::size_t i = 0; i != doc.size(); ++i) {
+        const auto ws = doc.view(i).ws;
+        w.write(ws.data(), ws.size());
+    }
+    return out;
+}
+
+namespace {
+auto read_ids(std::string_view data) -> std::vector<stroke_id>
+{
+    reader r{data};
+    const auto count = r.read<std::uint64_t>() & ~has_orders;
+    if (count > data.size() / 8) {
+        throw bad_document{"stroke id table is truncated"};
+    }
+    std::vector<stroke_id> ids(count);
+    r.read(ids.data(), ids.size());
+    return ids;
+}
+/// Orders following count ids, or nothing if there are none
+auto read_orders(std::string_view data, std::size_t count)
+    -> std::vector<stroke_id>
+{
+    if (!(reader{data}.read<std::uint64_t>() & has_orders)) {
+        return {};
+    }
+    std::vector<stroke_id> orders(count);
+    reader{data.substr(8 + count * 8)}.read(orders.data(), orders.size());
+    return orders;
+}
+} // namespace
+
+stored_reader::stored_reader(std::string_view data)
+    : ids_{read_ids(data)},
+      orders_{read_orders(data, ids_.size())},
+      strokes_{data.substr(8 + (ids_.size() + orders_.size()) * 8)}
+{
+    if (strokes_.size() != ids_.size()) {
+        throw bad_document{"mismatched stroke ids"};
+    }
+}
+
+auto stored_reader::next() -> stored_stroke
+{
+    const auto i = next_++;
+    stored_stroke s{ids_[i], strokes_.next()};
+    if (!orders_.empty() && orders_[i] != s.id) {
+        s.cut_from = orders_[i];
+    }
+    return s;
+}
+
+auto from_binary_stored(std::string_view data) -> std::vector<stored_stroke>
+{
+    stored_reader r{data};
+    std::vector<stored_stroke> out;
+    out.reserve(r.ids().size());
+    while (!r.done()) {
+        out.emplace_back(r.next());
+    }
+    return out;
+}
+} // namespace sketchy
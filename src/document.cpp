@@ -0,0 +1,535 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "document.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+namespace sketchy {
+namespace {
+/// Points in a block, unless one stroke needs more
+constexpr std::size_t block_points = 64 * 1024;
+/// Side of the cells of the grid over stroke bounds
+constexpr double index_cell = 256;
+/// Strokes meeting more cells than this are left out of the grid
+constexpr std::int64_t index_max_cells = 64;
+
+/// Cell of the grid over bounds holding v, clamped so far off areas still
+/// have one
+auto cell_of(double v) -> std::int32_t
+{
+    constexpr double lo = std::numeric_limits<std::int32_t>::min();
+    constexpr double hi = std::numeric_limits<std::int32_t>::max();
+    return static_cast<std::int32_t>(
+        std::clamp(std::floor(v / index_cell), lo, hi));
+}
+
+/// Reorder col so that element i is what was at perm[i]
+template<typename T>
+void permute(std::vector<T>& col, const std::vector<std::size_t>& perm,
+             std::size_t from)
+{
+    std::vector<T> out;
+    out.reserve(perm.size());
+    for (const auto i : perm) {
+        out.push_back(col[i]);
+    }
+    std::copy(out.begin(), out.end(),
+              col.begin() + static_cast<std::ptrdiff_t>(from));
+}
+
+/// Drop every element of col whose keep flag is 0
+template<typename T>
+void retain(std::vector<T>& col, const std::vector<std::uint8_t>& keep)
+{
+    std::size_t to = 0;
+    for (std::size_t i = 0; i != col.size(); ++i) {
+        if (keep[i]) {
+            col[to++] = col[i];
+        }
+    }
+    col.resize(to);
+}
+} // namespace
+
+auto stroke_view::to_stroke() const -> detail::stroke
+{
+    detail::stroke s{colour};
+    s.points.reserve(size());
+    for (std::size_t i = 0; i != size(); ++i) {
+        s.points.push_back(point(i));
+    }
+    return s;
+}
+
+auto stroke_view::to_stored() const -> stored_stroke
+{
+    stored_stroke s{id, to_stroke()};
+    if (order != id) {
+        s.cut_from = order;
+    }
+    return s;
+}
+
+auto document::order_of(stroke_id id) const -> stroke_id
+{
+    const auto it = cut_.find(id);
+    return it == cut_.end() ? id : it->second;
+}
+
+auto document::lower_bound(std::size_t from, std::size_t to, stroke_id order,
+                           stroke_id id) const -> std::size_t
+{
+    auto count = to - from;
+    while (count > 0) {
+        const auto half = count / 2;
+        const auto mid = from + half;
+        if (std::tie(orders_[mid], ids_[mid]) < std::tie(order, id)) {
+            from = mid + 1;
+            count -= half + 1;
+        }
+        else {
+            count = half;
+        }
+    }
+    return from;
+}
+
+auto document::find(stroke_id id) const -> std::size_t
+{
+    const auto i = lower_bound(0, size(), order_of(id), id);
+    return i != size() && ids_[i] == id ? i : size();
+}
+
+auto document::view(std::size_t i) const -> stroke_view
+{
+    const auto& b = *blocks_[block_[i]];
+    const auto first = first_[i];
+    const auto n = count_[i];
+    return {ids_[i],
+            orders_[i],
+            QPointF{static_cast<double>(chunk_x_[i]) * chunk_size,
+                    static_cast<double>(chunk_y_[i]) * chunk_size},
+            {b.xs.data() + first, n},
+            {b.ys.data() + first, n},
+            {b.ws.data() + first, n},
+            QColor::fromRgba(palette_[colour_[i]]),
+            n == 0 ? QRectF{}
+                   : QRectF{QPointF{min_x_[i], min_y_[i]},
+                            QPointF{max_x_[i], max_y_[i]}}};
+}
+
+auto document::get(stroke_id id) const -> stroke_view
+{
+    const auto i = find(id);
+    if (i == size()) {
+        throw std::out_of_range{"no stroke with that id"};
+    }
+    return view(i);
+}
+
+auto document::writable_block(std::size_t points) -> std::uint32_t
+{
+    const auto reserve = [](block& b, std::size_t cap) {
+        b.xs.reserve(cap);
+        b.ys.reserve(cap);
+        b.ws.reserve(cap);
+    };
+    if (!blocks_.empty() &&
+        blocks_.back()->xs.size() + points <= block_points) {
+        auto& b = blocks_.back();
+        // Copies may be reading it, so it is never written in place once
+        // shared. The copy is at most one block, however often snapshots
+        // are taken
+        if (b.use_count() > 1) {
+            auto own = std::make_shared<block>(*b);
+            reserve(*own, block_points);
+            b = std::move(own);
+        }
+        if (b->xs.size() + points <= b->xs.capacity()) {
+            return static_cast<std::uint32_t>(blocks_.size() - 1);
+        }
+    }
+    auto b = std::make_shared<block>();
+    reserve(*b, std::max(block_points, points));
+    blocks_.push_back(std::move(b));
+    return static_cast<std::uint32_t>(blocks_.size() - 1);
+}
+
+auto document::colour_index(QRgb c) -> std::uint32_t
+{
+    // Documents rarely have more than a handful of colours
+    const auto it = std::find(palette_.begin(), palette_.end(), c);
+    if (it != palette_.end()) {
+        return static_cast<std::uint32_t>(it - palette_.begin());
+    }
+    palette_.push_back(c);
+    return static_cast<std::uint32_t>(palette_.size() - 1);
+}
+
+void document::append(stroke_id id, const detail::stroke& s,
+                      stroke_id order)
+{
+    const auto n = s.points.size();
+    const auto bi = writable_block(n);
+    auto& b = *blocks_[bi];
+    const auto start = n == 0 ? QPointF{} : s.points.front().pos;
+    const auto cx = static_cast<std::int64_t>(std::floor(start.x() /
+                                                         chunk_size));
+    const auto cy = static_cast<std::int64_t>(std::floor(start.y() /
+                                                         chunk_size));
+    const auto ox = static_cast<double>(cx) * chunk_size;
+    const auto oy = static_cast<double>(cy) * chunk_size;
+    ids_.push_back(id);
+    orders_.push_back(order);
+    if (order != id) {
+        cut_.emplace(id, order);
+    }
+    chunk_x_.push_back(cx);
+    chunk_y_.push_back(cy);
+    block_.push_back(bi);
+    first_.push_back(static_cast<std::uint32_t>(b.xs.size()));
+    count_.push_back(static_cast<std::uint32_t>(n));
+    colour_.push_back(colour_index(s.colour.rgba()));
+    for (const auto& p : s.points) {
+        b.xs.push_back(static_cast<float>(p.pos.x() - ox));
+        b.ys.push_back(static_cast<float>(p.pos.y() - oy));
+        b.ws.push_back(p.weight);
+    }
+    if (n == 0) {
+        // Inverted, so it never counts towards any bounds
+        constexpr auto inf = std::numeric_limits<double>::infinity();
+        min_x_.push_back(inf);
+        min_y_.push_back(inf);
+        max_x_.push_back(-inf);
+        max_y_.push_back(-inf);
+    }
+    else {
+        const auto r = s.bounds();
+        min_x_.push_back(r.left());
+        min_y_.push_back(r.top());
+        max_x_.push_back(r.right());
+        max_y_.push_back(r.bottom());
+    }
+    live_points_ += n;
+    index(size() - 1);
+}
+
+void document::index(std::size_t i)
+{
+    if (count_[i] == 0) {
+        return;
+    }
+    const auto x0 = cell_of(min_x_[i]);
+    const auto y0 = cell_of(min_y_[i]);
+    const auto x1 = cell_of(max_x_[i]);
+    const auto y1 = cell_of(max_y_[i]);
+    if ((std::int64_t{x1} - x0 + 1) * (std::int64_t{y1} - y0 + 1) >
+        index_max_cells) {
+        large_.push_back(ids_[i]);
+        return;
+    }
+    for (auto y = y0; y <= y1; ++y) {
+        for (auto x = x0; x <= x1; ++x) {
+            cells_[tile_coord{x, y}].push_back(ids_[i]);
+        }
+    }
+}
+
+void document::unindex(std::size_t i)
+{
+    if (count_[i] == 0) {
+        return;
+    }
+    const auto id = ids_[i];
+    const auto x0 = cell_of(min_x_[i]);
+    const auto y0 = cell_of(min_y_[i]);
+    const auto x1 = cell_of(max_x_[i]);
+    const auto y1 = cell_of(max_y_[i]);
+    if ((std::int64_t{x1} - x0 + 1) * (std::int64_t{y1} - y0 + 1) >
+        index_max_cells) {
+        std::erase(large_, id);
+        return;
+    }
+    for (auto y = y0; y <= y1; ++y) {
+        for (auto x = x0; x <= x1; ++x) {
+            const auto it = cells_.find(tile_coord{x, y});
+            if (it == cells_.end()) {
+                continue;
+            }
+            std::erase(it->second, id);
+            if (it->second.empty()) {
+                cells_.erase(it);
+            }
+        }
+    }
+}
+
+void document::add(stroke_id id, const detail::stroke& s,
+                   std::optional<stroke_id> cut_from)
+{
+    const auto order = cut_from.value_or(id);
+    const auto in_order =
+        empty() || std::tie(orders_.back(), ids_.back()) < std::tie(order, id);
+    append(id, s, order);
+    if (!in_order) {
+        restore_order(size() - 1);
+    }
+}
+
+void document::add(const std::vector<stored_stroke>& strokes)
+{
+    const auto before = size();
+    for (const auto& s : strokes) {
+        append(s.id, s.data, s.order());
+    }
+    const auto stacked = [this](auto l, auto r) {
+        return std::tie(orders_[l], ids_[l]) < std::tie(orders_[r], ids_[r]);
+    };
+    for (auto i = std::max<std::size_t>(before, 1); i < size(); ++i) {
+        if (stacked(i, i - 1)) {
+            restore_order(before);
+            return;
+        }
+    }
+}
+
+void document::restore_order(std::size_t sorted)
+{
+    const auto stacked = [this](auto l, auto r) {
+        return std::tie(orders_[l], ids_[l]) < std::tie(orders_[r], ids_[r]);
+    };
+    std::vector<std::size_t> added(size() - sorted);
+    std::iota(added.begin(), added.end(), sorted);
+    std::sort(added.begin(), added.end(), stacked);
+    // Strokes below the lowest added stay where they are, the rest are
+    // merged with what was added
+    const auto lowest = added.front();
+    const auto from = lower_bound(0, sorted, orders_[lowest], ids_[lowest]);
+    std::vector<std::size_t> kept(sorted - from);
+    std::iota(kept.begin(), kept.end(), from);
+    std::vector<std::size_t> perm;
+    perm.reserve(size() - from);
+    std::merge(kept.begin(), kept.end(), added.begin(), added.end(),
+               std::back_inserter(perm), stacked);
+    permute(ids_, perm, from);
+    permute(orders_, perm, from);
+    permute(chunk_x_, perm, from);
+    permute(chunk_y_, perm, from);
+    permute(block_, perm, from);
+    permute(first_, perm, from);
+    permute(count_, perm, from);
+    permute(colour_, perm, from);
+    permute(min_x_, perm, from);
+    permute(min_y_, perm, from);
+    permute(max_x_, perm, from);
+    permute(max_y_, perm, from);
+}
+
+void document::remove(std::span<const stroke_id> ids)
+{
+    std::vector<std::uint8_t> keep(size(), 1);
+    auto removed = false;
+    for (const auto id : ids) {
+        if (const auto i = find(id); i != size() && keep[i]) {
+            keep[i] = 0;
+            unindex(i);
+            cut_.erase(id);
+            live_points_ -= count_[i];
+            dead_points_ += count_[i];
+            removed = true;
+        }
+    }
+    if (!removed) {
+        return;
+    }
+    retain(ids_, keep);
+    retain(orders_, keep);
+    retain(chunk_x_, keep);
+    retain(chunk_y_, keep);
+    retain(block_, keep);
+    retain(first_, keep);
+    retain(count_, keep);
+    retain(colour_, keep);
+    retain(min_x_, keep);
+    retain(min_y_, keep);
+    retain(max_x_, keep);
+    retain(max_y_, keep);
+    if (dead_points_ > std::max(live_points_, block_points)) {
+        reclaim();
+    }
+}
+
+void document::reclaim()
+{
+    // Copies keep the old blocks alive for as long as they need them
+    const auto old = std::move(blocks_);
+    blocks_.clear();
+    for (std::size_t i = 0; i != size(); ++i) {
+        const auto& from = *old[block_[i]];
+        const auto bi = writable_block(count_[i]);
+        auto& to = *blocks_[bi];
+        const auto first = static_cast<std::ptrdiff_t>(first_[i]);
+        const auto last = first + static_cast<std::ptrdiff_t>(count_[i]);
+        block_[i] = bi;
+        first_[i] = static_cast<std::uint32_t>(to.xs.size());
+        to.xs.insert(to.xs.end(), from.xs.begin() + first,
+                     from.xs.begin() + last);
+        to.ys.insert(to.ys.end(), from.ys.begin() + first,
+                     from.ys.begin() + last);
+        to.ws.insert(to.ws.end(), from.ws.begin() + first,
+                     from.ws.begin() + last);
+    }
+    dead_points_ = 0;
+}
+
+void document::clear()
+{
+    *this = document{};
+}
+
+auto document::bounds() const -> QRectF
+{
+    if (empty()) {
+        return {};
+    }
+    const auto left = *std::min_element(min_x_.begin(), min_x_.end());
+    const auto top = *std::min_element(min_y_.begin(), min_y_.end());
+    const auto right = *std::max_element(max_x_.begin(), max_x_.end());
+    const auto bottom = *std::max_element(max_y_.begin(), max_y_.end());
+    if (!std::isfinite(left)) {
+        return {};
+    }
+    return QRectF{QPointF{left, top}, QPointF{right, bottom}};
+}
+
+void document::query(const QRectF& area, std::vector<std::size_t>& out) const
+{
+    out.clear();
+    const auto l = area.left();
+    const auto t = area.top();
+    const auto r = area.right();
+    const auto b = area.bottom();
+    const auto x0 = cell_of(l);
+    const auto y0 = cell_of(t);
+    const auto x1 = cell_of(r);
+    const auto y1 = cell_of(b);
+    thread_local std::vector<stroke_id> found;
+    found.assign(large_.begin(), large_.end());
+    const auto take = [](const std::vector<stroke_id>& ids) {
+        found.insert(found.end(), ids.begin(), ids.end());
+    };
+    // Zoomed far out the area can cover more cells than are in use
+    if ((std::int64_t{x1} - x0 + 1) * (std::int64_t{y1} - y0 + 1) >
+        static_cast<std::int64_t>(cells_.size())) {
+        for (const auto& [c, ids] : cells_) {
+            if (c.x >= x0 && c.x <= x1 && c.y >= y0 && c.y <= y1) {
+                take(ids);
+            }
+        }
+    }
+    else {
+        for (auto y = y0; y <= y1; ++y) {
+            for (auto x = x0; x <= x1; ++x) {
+                if (const auto it = cells_.find(tile_coord{x, y});
+                    it != cells_.end()) {
+                    take(it->second);
+                }
+            }
+        }
+    }
+    // Positions are in stacking order, so sorting by it sorts them too
+    thread_local std::vector<std::pair<stroke_id, stroke_id>> keys;
+    keys.clear();
+    for (const auto id : found) {
+        keys.emplace_back(order_of(id), id);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::size_t i = 0;
+    for (const auto& [order, id] : keys) {
+        i = lower_bound(i, size(), order, id);
+        if (i == size()) {
+            break;
+        }
+        if (min_x_[i] <= r && max_x_[i] >= l && min_y_[i] <= b &&
+            max_y_[i] >= t) {
+            out.push_back(i);
+        }
+    }
+}
+
+auto document::memory_parts() const -> memory
+{
+    memory m{};
+    for (const auto& b : blocks_) {
+        m.points += (b->xs.capacity() + b->ys.capacity() + b->ws.capacity()) *
+                    sizeof(float);
+    }
+    m.removed_points = dead_points_ * point_bytes;
+    const auto per_stroke = 2 * sizeof(stroke_id) +
+                            2 * sizeof(std::int64_t) +
+                            4 * sizeof(std::uint32_t) + 4 * sizeof(double);
+    m.strokes = ids_.capacity() * per_stroke +
+                cut_.size() * (2 * sizeof(stroke_id) + 2 * sizeof(void*)) +
+                blocks_.capacity() * sizeof(std::shared_ptr<block>) +
+                large_.capacity() * sizeof(stroke_id) +
+                cells_.bucket_count() * sizeof(void*);
+    for (const auto& [c, ids] : cells_) {
+        // Roughly what a node costs on top of the ids it holds
+        m.strokes += sizeof(c) + sizeof(ids) + 2 * sizeof(void*) +
+                     ids.capacity() * sizeof(stroke_id);
+    }
+    m.palette = palette_.capacity() * sizeof(QRgb);
+    m.blocks = blocks_.size();
+    return m;
+}
+auto document::memory_usage() const -> std::size_t
+{
+    const auto m = memory_parts();
+    return m.points + m.strokes + m.palette;
+}
+
+auto document::stored() const -> std::vector<stored_stroke>
+{
+    std::vector<stored_stroke> out;
+    out.reserve(size());
+    for (std::size_t i = 0; i != size(); ++i) {
+        out.push_back(view(i).to_stored());
+    }
+    return out;
+}
+
+auto document::strokes() const -> std::vector<detail::stroke>
+{
+    std::vector<detail::stroke> out;
+    out.reserve(size());
+    for (std::size_t i = 0; i != size(); ++i) {
+        out.push_back(view(i).to_stroke());
+    }
+    return out;
+}
+
+} // namespace sketchy
@@ -0,0 +1,177 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "storage.hpp"
+#include "tile_store.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sketchy {
+
+/// Side of the square chunks the canvas is split into
+inline constexpr double chunk_size = 1024;
+
+/// Read-only view of one stroke in a document. Valid until the document is
+/// next modified
+struct stroke_view {
+    stroke_id id;
+    /// See stored_stroke::order()
+    stroke_id order;
+    /// Corner of the chunk the stroke starts in, xs and ys are relative to
+    /// it
+    QPointF origin;
+    std::span<const float> xs;
+    std::span<const float> ys;
+    std::span<const float> ws;
+    QColor colour;
+    QRectF bounds;
+
+    auto size() const -> std::size_t { return xs.size(); }
+    auto empty() const -> bool { return xs.empty(); }
+    auto point(std::size_t i) const -> detail::stroke::point
+    {
+        return {{origin.x() + xs[i], origin.y() + ys[i]}, ws[i]};
+    }
+    auto to_stroke() const -> detail::stroke;
+    auto to_stored() const -> stored_stroke;
+};
+
+/// Every finished stroke, in stacking order (stored_stroke::order(), then
+/// id).
+///
+/// Points are stored column-wise, x, y and weight, in large blocks with
+/// each stroke a contiguous range of one block. Positions are floats
+/// relative to the integer chunk the stroke starts in, so they are compact
+/// and just as precise however far from the origin they are. Everything per
+/// stroke (id, chunk, colour index, where its points are, bounds) is
+/// column-wise too, with a grid over the bounds for finding strokes by
+/// area. Blocks are shared between copies and never written once another
+/// copy holds them, so a copy only duplicates the per-stroke columns and
+/// the grid and can be handed to another thread as a snapshot
+class document {
+public:
+    auto size() const -> std::size_t { return ids_.size(); }
+    auto empty() const -> bool { return ids_.empty(); }
+    /// Points in strokes which have not been removed
+    auto points() const -> std::size_t { return live_points_; }
+
+    /// Position of id in stacking order, or size() if it is not here
+    auto find(stroke_id id) const -> std::size_t;
+    auto contains(stroke_id id) const -> bool { return find(id) != size(); }
+    auto id(std::size_t i) const -> stroke_id { return ids_[i]; }
+    auto order(std::size_t i) const -> stroke_id { return orders_[i]; }
+    auto view(std::size_t i) const -> stroke_view;
+    /// Throws std::out_of_range if id is not here
+    auto get(stroke_id id) const -> stroke_view;
+
+    /// ids must not be here already, but can come in any order. cut_from
+    /// is as for stored_stroke
+    void add(stroke_id id, const detail::stroke& s,
+             std::optional<stroke_id> cut_from = {});
+    void add(const std::vector<stored_stroke>& strokes);
+    /// Ids which are not here are skipped
+    void remove(std::span<const stroke_id> ids);
+    void clear();
+
+    /// Union of the bounds of every stroke
+    auto bounds() const -> QRectF;
+    /// Replace out with the positions of strokes whose bounds meet area, in
+    /// stacking order
+    void query(const QRectF& area, std::vector<std::size_t>& out) const;
+
+    /// Bytes each point takes in the blocks
+    static constexpr std::size_t point_bytes = 3 * sizeof(float);
+
+    /// Heap bytes held, by part
+    struct memory {
+        std::size_t points;
+        /// Part of points held by removed strokes until reclaimed
+        std::size_t removed_points;
+        std::size_t strokes;
+        std::size_t palette;
+        std::size_t blocks;
+    };
+    auto memory_parts() const -> memory;
+    /// Heap bytes held, counting points of removed strokes until reclaimed
+    auto memory_usage() const -> std::size_t;
+
+    auto stored() const -> std::vector<stored_stroke>;
+    auto strokes() const -> std::vector<detail::stroke>;
+
+private:
+    struct block {
+        std::vector<float> xs;
+        std::vector<float> ys;
+        std::vector<float> ws;
+    };
+
+    void append(stroke_id id, const detail::stroke& s, stroke_id order);
+    auto order_of(stroke_id id) const -> stroke_id;
+    /// First position in [from, to) which does not stack below order, id
+    auto lower_bound(std::size_t from, std::size_t to, stroke_id order,
+                     stroke_id id) const -> std::size_t;
+    auto writable_block(std::size_t points) -> std::uint32_t;
+    auto colour_index(QRgb c) -> std::uint32_t;
+    /// Put strokes back in stacking order once some have been appended
+    /// after the first sorted, which are in order. Only strokes from where
+    /// the lowest appended goes move, so a batch costs its own sort and a
+    /// merge rather than sorting everything
+    void restore_order(std::size_t sorted);
+    void reclaim();
+    /// Put stroke i in the grid over bounds, or take it out
+    void index(std::size_t i);
+    void unindex(std::size_t i);
+
+    std::vector<std::shared_ptr<block>> blocks_;
+    std::vector<QRgb> palette_;
+
+    std::vector<stroke_id> ids_;
+    std::vector<stroke_id> orders_;
+    /// Order of each stroke cut from another, the rest stack by their id
+    std::unordered_map<stroke_id, stroke_id> cut_;
+    std::vector<std::int64_t> chunk_x_;
+    std::vector<std::int64_t> chunk_y_;
+    std::vector<std::uint32_t> block_;
+    std::vector<std::uint32_t> first_;
+    std::vector<std::uint32_t> count_;
+    std::vector<std::uint32_t> colour_;
+    std::vector<double> min_x_;
+    std::vector<double> min_y_;
+    std::vector<double> max_x_;
+    std::vector<double> max_y_;
+
+    /// Ids of the strokes whose bounds meet each cell. Strokes spanning
+    /// too many cells go in large_ instead, which every query checks
+    std::unordered_map<tile_coord, std::vector<stroke_id>> cells_;
+    std::vector<stroke_id> large_;
+
+    std::size_t live_points_{0};
+    std::size_t dead_points_{0};
+};
+
+/// Same bytes as to_binary(doc.stored()), written straight from the columns
+auto to_binary(const document& doc) -> std::string;
+
+} // namespace sketchy
@@ -0,0 +1,234 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "eraser.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sketchy {
+
+template<typename F>
+void segment_grid::for_each_cell(const stroke_view& s, F&& f) const
+{
+    const auto n = s.size();
+    for (std::size_t i = 0; i + 1 < std::max<std::size_t>(n, 2); ++i) {
+        const auto j = n > 1 ? i + 1 : i;
+        const auto a = s.point(i).pos;
+        const auto b = s.point(j).pos;
+        const auto m = std::max(s.ws[i], s.ws[j]) / 2.0;
+        const auto tl = tile_of(QPointF{std::min(a.x(), b.x()) - m,
+                                        std::min(a.y(), b.y()) - m},
+                                cell_size_);
+        const auto br = tile_of(QPointF{std::max(a.x(), b.x()) + m,
+                                        std::max(a.y(), b.y()) + m},
+                                cell_size_);
+        for (auto y = tl.y; y <= br.y; ++y) {
+            for (auto x = tl.x; x <= br.x; ++x) {
+                f(tile_coord{x, y}, static_cast<std::uint32_t>(i));
+            }
+        }
+    }
+}
+
+void segment_grid::insert(const stroke_view& s)
+{
+    if (s.empty()) {
+        return;
+    }
+    const auto id = s.id;
+    for_each_cell(s, [&](tile_coord c, std::uint32_t seg) {
+        auto& runs = cells_[c];
+        if (!runs.empty() && runs.back().id == id &&
+            runs.back().first + runs.back().count == seg) {
+            runs.back().count = seg - runs.back().first + 1;
+        }
+        else {
+            runs.push_back({id, seg, 1});
+        }
+    });
+}
+
+void segment_grid::remove(const stroke_view& s)
+{
+    if (s.empty()) {
+        return;
+    }
+    const auto id = s.id;
+    for_each_cell(s, [&](tile_coord c, std::uint32_t) {
+        auto it = cells_.find(c);
+        if (it == cells_.end()) {
+            return;
+        }
+        std::erase_if(it->second,
+                      [id](const auto& run) { return run.id == id; });
+        if (it->second.empty()) {
+            cells_.erase(it);
+        }
+    });
+}
+
+auto segment_grid::query(const QRectF& area) const -> std::vector<segment_run>
+{
+    std::unordered_map<stroke_id, segment_run> found;
+    const auto tl = tile_of(area.topLeft(), cell_size_);
+    const auto br = tile_of(area.bottomRight(), cell_size_);
+    for (auto y = tl.y; y <= br.y; ++y) {
+        for (auto x = tl.x; x <= br.x; ++x) {
+            const auto it = cells_.find(tile_coord{x, y});
+            if (it == cells_.end()) {
+                continue;
+            }
+            for (const auto& run : it->second) {
+                auto [at, added] = found.try_emplace(run.id, run);
+                if (!added) {
+                    auto& span = at->second;
+                    const auto end = std::max(span.first + span.count,
+                                              run.first + run.count);
+                    span.first = std::min(span.first, run.first);
+                    span.count = end - span.first;
+                }
+            }
+        }
+    }
+    std::vector<segment_run> out;
+    out.reserve(found.size());
+    for (const auto& [id, run] : found) {
+        out.emplace_back(run);
+    }
+    return out;
+}
+
+namespace detail {
+void segments_within(const float* xs, const float* ys, const float* ws,
+                     std::size_t points, double cx, double cy, double r,
+                     std::uint8_t* hit)
+{
+    for (std::size_t i = 0; i + 1 < points; ++i) {
+        const auto ax = static_cast<double>(xs[i]);
+        const auto ay = static_cast<double>(ys[i]);
+        const auto dx = xs[i + 1] - ax;
+        const auto dy = ys[i + 1] - ay;
+        const auto len2 = std::max(dx * dx + dy * dy, 1e-12);
+        const auto t =
+            std::clamp(((cx - ax) * dx + (cy - ay) * dy) / len2, 0.0, 1.0);
+        const auto px = ax + t * dx - cx;
+        const auto py = ay + t * dy - cy;
+        const auto rr = r + ws[i + 1] * 0.5;
+        hit[i] = px * px + py * py <= rr * rr;
+    }
+}
+} // namespace detail
+
+namespace {
+/// Where along a -> b the segment enters and leaves the circle, clamped to
+/// [0, 1]
+auto circle_span(const QPointF& a, const QPointF& b, const QPointF& c,
+                 double r) -> std::pair<double, double>
+{
+    const auto d = b - a;
+    const auto f = a - c;
+    const auto qa = QPointF::dotProduct(d, d);
+    const auto qb = 2 * QPointF::dotProduct(f, d);
+    const auto qc = QPointF::dotProduct(f, f) - r * r;
+    const auto disc = qb * qb - 4 * qa * qc;
+    if (qa <= 0 || disc < 0) {
+        return {0, 1};
+    }
+    const auto root = std::sqrt(disc);
+    return {std::clamp((-qb - root) / (2 * qa), 0.0, 1.0),
+            std::clamp((-qb + root) / (2 * qa), 0.0, 1.0)};
+}
+
+auto point_between(const detail::stroke::point& a,
+                   const detail::stroke::point& b, double t)
+    -> detail::stroke::point
+{
+    return {a.pos + (b.pos - a.pos) * t,
+            static_cast<float>(a.weight + (b.weight - a.weight) * t)};
+}
+} // namespace
+
+auto erase_circle(const stroke_view& s, const segment_run& span,
+                  const QPointF& centre, double r, bool split)
+    -> std::optional<std::vector<detail::stroke>>
+{
+    const auto size = s.size();
+    if (size < 2) {
+        if (size == 0) {
+            return std::nullopt;
+        }
+        const auto d = s.point(0).pos - centre;
+        const auto rr = r + s.ws[0] / 2.0;
+        if (QPointF::dotProduct(d, d) > rr * rr) {
+            return std::nullopt;
+        }
+        return std::vector<detail::stroke>{};
+    }
+
+    // The kernel runs straight over the candidate span of the document,
+    // with the centre moved into the stroke's chunk
+    thread_local std::vector<std::uint8_t> hit;
+    const auto first = std::min<std::size_t>(span.first, size - 1);
+    const auto n = std::min<std::size_t>(span.count + 1, size - first);
+    const auto local = centre - s.origin;
+    hit.assign(n, 0);
+    detail::segments_within(s.xs.data() + first, s.ys.data() + first,
+                            s.ws.data() + first, n, local.x(), local.y(), r,
+                            hit.data());
+    if (std::none_of(hit.begin(), hit.end(), [](auto h) { return h; })) {
+        return std::nullopt;
+    }
+
+    std::vector<detail::stroke> pieces;
+    if (!split) {
+        return pieces;
+    }
+    detail::stroke curr{s.colour};
+    const auto close = [&] {
+        if (curr.points.size() > 1) {
+            pieces.emplace_back(std::move(curr));
+        }
+        curr = detail::stroke{s.colour};
+    };
+    for (std::size_t i = 0; i + 1 < size; ++i) {
+        const auto a = s.point(i);
+        const auto b = s.point(i + 1);
+        if (curr.empty()) {
+            curr.append(a);
+        }
+        const auto in_span = i >= first && i - first + 1 < n;
+        if (!in_span || !hit[i - first]) {
+            curr.append(b);
+            continue;
+        }
+        const auto [t0, t1] =
+            circle_span(a.pos, b.pos, centre, r + b.weight / 2.0);
+        if (t0 > 0) {
+            curr.append(point_between(a, b, t0));
+        }
+        close();
+        if (t1 < 1) {
+            curr.append(point_between(a, b, t1));
+            curr.append(b);
+        }
+    }
+    close();
+    return pieces;
+}
+
+} // namespace sketchy
@@ -0,0 +1,81 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "document.hpp"
+#include "tile_store.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace sketchy {
+
+/// Run of consecutive segments of a stroke, segment i goes from point i to
+/// point i + 1
+struct segment_run {
+    stroke_id id;
+    std::uint32_t first;
+    std::uint32_t count;
+};
+
+/// Uniform grid over the segments of every stroke. Each cell keeps runs of
+/// consecutive segments, so a stroke passing through a cell usually costs
+/// one entry there
+class segment_grid {
+public:
+    explicit segment_grid(double cell_size = 64) : cell_size_{cell_size} {}
+
+    void insert(const stroke_view& s);
+    /// s must be the same as what was inserted under its id
+    void remove(const stroke_view& s);
+    void clear() { cells_.clear(); }
+
+    /// For every stroke with a segment near area, the smallest run covering
+    /// all of its segments there
+    auto query(const QRectF& area) const -> std::vector<segment_run>;
+
+private:
+    template<typename F>
+    void for_each_cell(const stroke_view& s, F&& f) const;
+
+    double cell_size_;
+    std::unordered_map<tile_coord, std::vector<segment_run>> cells_;
+};
+
+namespace detail {
+/// Sets hit[i] for every segment i of the points which comes within r, plus
+/// half the width of the segment, of (cx, cy). Written over flat arrays
+/// without branches so the compiler can vectorize it. Positions are chunk
+/// relative, as stored in a document
+void segments_within(const float* xs, const float* ys, const float* ws,
+                     std::size_t points, double cx, double cy, double r,
+                     std::uint8_t* hit);
+} // namespace detail
+
+/// Erase a circle from the segments of s in span. Returns nullopt if the
+/// circle missed. Otherwise returns what is left: nothing if the whole
+/// stroke goes, or with split the pieces either side of the cut, clipped
+/// to the edge of the circle. Reads the points in place, nothing is copied
+/// unless the circle hits
+auto erase_circle(const stroke_view& s, const segment_run& span,
+                  const QPointF& centre, double r, bool split)
+    -> std::optional<std::vector<detail::stroke>>;
+
+} // namespace sketchy
@@ -0,0 +1,427 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "journal.hpp"
+#include "binary_io.hpp"
+
+#include <qfile.h>
+#include <qsavefile.h>
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * File layout, integers little-endian:
+ *
+ *   "SKJOURN\0" u32 version u32 reserved
+ *   record*
+ *
+ * record:
+ *   u32 payload length
+ *   u32 crc32 of the type byte and payload
+ *   u8  type, 0 = snapshot, 1 = changeset
+ *   u8[3] padding
+ *   payload:
+ *     u64 erased count, u64 erased ids[]
+ *     added strokes with their ids (see to_binary in binary_storage.cpp)
+ */
+
+namespace sketchy {
+namespace {
+constexpr std::string_view journal_magic{"SKJOURN\0", 8};
+constexpr std::uint32_t journal_version = 1;
+constexpr std::size_t file_header_size = 16;
+constexpr std::size_t record_header_size = 12;
+/// Changesets smaller than this never trigger a compaction
+constexpr std::uint64_t min_compact_size = 64 * 1024;
+/// Snapshots are written in pieces this big so progress can be reported
+constexpr std::size_t write_chunk = 1024 * 1024;
+
+enum class record_type : std::uint8_t {
+    snapshot = 0,
+    changeset = 1,
+};
+
+void put_u32(std::string& out, std::uint32_t v)
+{
+    detail::writer{out}.write(v);
+}
+auto get_u32(std::string_view in) -> std::uint32_t
+{
+    return detail::reader{in}.read<std::uint32_t>();
+}
+
+auto frame_record(record_type type, const std::vector<stroke_id>& erased,
+                  const std::string& added) -> std::string
+{
+    std::string payload;
+    payload.reserve(1 + 8 + erased.size() * 8 + added.size());
+    payload.push_back(static_cast<char>(type));
+    detail::writer w{payload};
+    w.write(static_cast<std::uint64_t>(erased.size()));
+    w.write(erased.data(), erased.size());
+    payload += added;
+
+    std::string out;
+    out.reserve(record_header_size + payload.size());
+    put_u32(out, static_cast<std::uint32_t>(payload.size() - 1));
+    put_u32(out, detail::crc32(payload));
+    out.push_back(payload.front());
+    out.append(3, '\0');
+    out.append(payload, 1);
+    return out;
+}
+
+auto encode_record(record_type type, const changeset& c) -> std::string
+{
+    return frame_record(type, c.erased, to_binary(c.added));
+}
+
+auto decode_changeset(std::string_view in) -> changeset
+{
+    detail::reader r{in};
+    const auto count = r.read<std::uint64_t>();
+    if (count > in.size() / 8) {
+        throw bad_document{"journal record is truncated"};
+    }
+    changeset c;
+    c.erased.resize(count);
+    r.read(c.erased.data(), c.erased.size());
+    c.added = from_binary_stored(in.substr(r.offset()));
+    return c;
+}
+
+/// Call f(type, payload, end) for each record in data up to the first
+/// which is short or fails its checksum, where end is the offset just past
+/// the record. Returns the length of the intact records
+template<typename F>
+auto scan_records(std::string_view data, F&& f) -> std::size_t
+{
+    std::size_t at = 0;
+    while (data.size() - at >= record_header_size) {
+        const auto rec = data.substr(at);
+        const auto len = get_u32(rec);
+        if (rec.size() - record_header_size < len) {
+            break;
+        }
+        // The type byte is checksummed along with the payload
+        const auto payload = rec.substr(record_header_size, len);
+        if (detail::crc32(payload, detail::crc32(rec.substr(8, 1))) !=
+            get_u32(rec.substr(4))) {
+            break;
+        }
+        at += record_header_size + len;
+        f(static_cast<record_type>(rec[8]), payload, at);
+    }
+    return at;
+}
+
+/// scan_records() with each payload decoded as a changeset
+template<typename F>
+auto read_records(std::string_view data, F&& f) -> std::size_t
+{
+    return scan_records(data, [&f](record_type type, std::string_view payload,
+                                   std::size_t end) {
+        f(type, decode_changeset(payload), end);
+    });
+}
+
+/// Document being rebuilt by replay. Erased strokes are tombstoned so the
+/// order they were added in (which is their stacking order) is kept
+class replay_state {
+public:
+    /// Erased ids which were not added by an earlier changeset are put in
+    /// missing
+    void apply(changeset c, std::unordered_set<stroke_id>& missing)
+    {
+        for (const auto id : c.erased) {
+            if (auto it = index_.find(id); it != index_.end()) {
+                strokes_[it->second].reset();
+                index_.erase(it);
+            }
+            else {
+                missing.insert(id);
+            }
+        }
+        for (auto& s : c.added) {
+            index_[s.id] = strokes_.size();
+            strokes_.emplace_back(std::move(s));
+        }
+    }
+    auto take() -> std::vector<stored_stroke>
+    {
+        std::vector<stored_stroke> out;
+        out.reserve(index_.size());
+        for (auto& s : strokes_) {
+            if (s) {
+                out.emplace_back(std::move(*s));
+            }
+        }
+        return out;
+    }
+
+private:
+    std::vector<std::optional<stored_stroke>> strokes_;
+    std::unordered_map<stroke_id, std::size_t> index_;
+};
+
+void sync(QFile& f)
+{
+    f.flush();
+#ifdef _WIN32
+    _commit(f.handle());
+#else
+    ::fsync(f.handle());
+#endif
+}
+
+auto file_header() -> std::string
+{
+    std::string out{journal_magic};
+    put_u32(out, journal_version);
+    put_u32(out, 0);
+    return out;
+}
+} // namespace
+
+namespace detail {
+auto crc32(std::string_view data, std::uint32_t crc) -> std::uint32_t
+{
+    static const auto table = [] {
+        std::array<std::uint32_t, 256> t{};
+        for (std::uint32_t i = 0; i != t.size(); ++i) {
+            auto c = i;
+            for (auto k = 0; k != 8; ++k) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (const auto ch : data) {
+        crc = table[(crc ^ static_cast<std::uint8_t>(ch)) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+auto changeset_record(const changeset& c) -> std::string
+{
+    return encode_record(record_type::changeset, c);
+}
+
+auto read_changesets(std::string_view data, std::vector<changeset>& out)
+    -> std::size_t
+{
+    return read_records(data, [&out](record_type, changeset c, std::size_t) {
+        out.push_back(std::move(c));
+    });
+}
+} // namespace detail
+
+journal::journal(QString path) : path_{std::move(path)} {}
+
+auto journal::is_journal(std::string_view data) -> bool
+{
+    return data.substr(0, journal_magic.size()) == journal_magic;
+}
+
+journal_reader::journal_reader(std::string_view data)
+{
+    if (!journal::is_journal(data) || data.size() < file_header_size) {
+        throw bad_document{"not a sketchy journal"};
+    }
+    if (get_u32(data.substr(journal_magic.size())) > journal_version) {
+        throw bad_document{"journal is from a newer version"};
+    }
+    // Everything before the last snapshot is replaced by it
+    std::string_view snapshot;
+    std::vector<std::string_view> changesets;
+    std::size_t snapshot_end = 0;
+    valid_size_ =
+        scan_records(data.substr(file_header_size),
+                     [&](record_type type, std::string_view payload,
+                         std::size_t end) {
+                         if (type == record_type::snapshot) {
+                             snapshot = payload;
+                             snapshot_end = end;
+                             changesets.clear();
+                         }
+                         else {
+                             changesets.push_back(payload);
+                         }
+                     }) +
+        file_header_size;
+    snapshot_size_ = snapshot_end + file_header_size;
+
+    if (snapshot_end != 0) {
+        detail::reader r{snapshot};
+        // Always empty, a snapshot has nothing before it to erase
+        const auto erased = r.read<std::uint64_t>();
+        if (erased > (snapshot.size() - 8) / 8) {
+            throw bad_document{"journal record is truncated"};
+        }
+        snapshot_.emplace(snapshot.substr(8 + erased * 8));
+        for (const auto id : snapshot_->ids()) {
+            next_id_ = std::max(next_id_, id + 1);
+        }
+    }
+    replay_state state;
+    for (const auto payload : changesets) {
+        auto c = decode_changeset(payload);
+        for (const auto& s : c.added) {
+            next_id_ = std::max(next_id_, s.id + 1);
+        }
+        state.apply(std::move(c), erased_);
+    }
+    added_ = state.take();
+}
+
+auto journal_reader::next() -> std::optional<stored_stroke>
+{
+    while (snapshot_ && !snapshot_->done()) {
+        auto s = snapshot_->next();
+        if (!erased_.contains(s.id)) {
+            return s;
+        }
+    }
+    if (next_added_ != added_.size()) {
+        return std::move(added_[next_added_++]);
+    }
+    return std::nullopt;
+}
+
+auto journal::replay(std::string_view data, std::uint64_t* valid_size,
+                     std::uint64_t* snapshot_size)
+    -> std::vector<stored_stroke>
+{
+    journal_reader r{data};
+    if (valid_size) {
+        *valid_size = r.valid_size();
+    }
+    if (snapshot_size) {
+        *snapshot_size = r.snapshot_size();
+    }
+    std::vector<stored_stroke> out;
+    while (auto s = r.next()) {
+        out.emplace_back(std::move(*s));
+    }
+    return out;
+}
+
+auto journal::read(std::string_view data) -> journal_reader
+{
+    journal_reader r{data};
+    size_ = r.valid_size();
+    snapshot_size_ = r.snapshot_size();
+    return r;
+}
+
+auto journal::load() -> std::vector<stored_stroke>
+{
+    QFile f{path_};
+    if (!f.open(QFile::ReadOnly)) {
+        throw bad_document{"failed to open journal"};
+    }
+    const auto data = f.readAll();
+    return replay({data.constData(), static_cast<std::size_t>(data.size())},
+                  &size_, &snapshot_size_);
+}
+
+void journal::append(const changeset& c)
+{
+    if (size_ == 0) {
+        throw io_error{"journal must be loaded or compacted before append"};
+    }
+    const auto rec = encode_record(record_type::changeset, c);
+    QFile f{path_};
+    if (!f.open(QFile::ReadWrite)) {
+        throw io_error{"failed to open journal for append"};
+    }
+    // Drop anything left over from a torn write so the new record follows
+    // directly on from the last good one
+    if (static_cast<std::uint64_t>(f.size()) != size_) {
+        f.resize(size_);
+    }
+    f.seek(size_);
+    if (f.write(rec.data(), rec.size()) != static_cast<qint64>(rec.size())) {
+        throw io_error{"failed to append to journal"};
+    }
+    sync(f);
+    size_ += rec.size();
+}
+
+void journal::compact(const std::vector<stored_stroke>& doc,
+                      const std::function<void(int)>& progress)
+{
+    write_snapshot(frame_record(record_type::snapshot, {}, to_binary(doc)),
+                   progress);
+}
+
+void journal::compact(const document& doc,
+                      const std::function<void(int)>& progress)
+{
+    write_snapshot(frame_record(record_type::snapshot, {}, to_binary(doc)),
+                   progress);
+}
+
+void journal::write_snapshot(const std::string& rec,
+                             const std::function<void(int)>& progress)
+{
+    const auto report = [&progress](int percent) {
+        if (progress) {
+            progress(percent);
+        }
+    };
+    report(50);
+    const auto header = file_header();
+    // Written to a temporary next to the file and renamed over it on commit
+    QSaveFile f{path_};
+    if (!f.open(QFile::WriteOnly)) {
+        throw io_error{"failed to open journal for compaction"};
+    }
+    f.write(header.data(), header.size());
+    for (std::size_t off = 0; off < rec.size(); off += write_chunk) {
+        const auto n = std::min(write_chunk, rec.size() - off);
+        if (f.write(rec.data() + off, static_cast<qint64>(n)) !=
+            static_cast<qint64>(n)) {
+            break;
+        }
+        report(50 + static_cast<int>((off + n) * 50 / rec.size()));
+    }
+    if (!f.commit()) {
+        throw io_error{"failed to write journal snapshot"};
+    }
+    size_ = header.size() + rec.size();
+    snapshot_size_ = size_;
+}
+
+auto journal::needs_compaction() const -> bool
+{
+    const auto deltas = size_ - snapshot_size_;
+    return deltas > min_compact_size &&
+           deltas > static_cast<std::uint64_t>(snapshot_size_ * compact_ratio_);
+}
+} // namespace sketchy
@@ -0,0 +1,134 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "document.hpp"
+#include "storage.hpp"
+
+#include <qstring.h>
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace sketchy {
+
+/// Strokes added and erased since some point in time
+struct changeset {
+    std::vector<stored_stroke> added;
+    std::vector<stroke_id> erased;
+
+    auto empty() const -> bool { return added.empty() && erased.empty(); }
+};
+
+/// Replays a journal a stroke at a time. Every record is found and checked
+/// and the changesets after the last snapshot are decoded up front, the
+/// snapshot itself is only decoded as its strokes are asked for. Views the
+/// data it was given, which has to outlive it
+class journal_reader {
+public:
+    explicit journal_reader(std::string_view data);
+
+    /// Higher than every id the journal has handed out
+    auto next_id() const -> stroke_id { return next_id_; }
+    /// Length of the intact records, and of the records up to and including
+    /// the last snapshot
+    auto valid_size() const -> std::uint64_t { return valid_size_; }
+    auto snapshot_size() const -> std::uint64_t { return snapshot_size_; }
+
+    /// The next stroke of the document, in the order they were added.
+    /// Empty once there are none left
+    auto next() -> std::optional<stored_stroke>;
+
+private:
+    std::optional<stored_reader> snapshot_;
+    /// Strokes in the snapshot which a later changeset erased
+    std::unordered_set<stroke_id> erased_;
+    /// Added by changesets after the snapshot and never erased
+    std::vector<stored_stroke> added_;
+    std::size_t next_added_{0};
+    stroke_id next_id_{0};
+    std::uint64_t valid_size_{0};
+    std::uint64_t snapshot_size_{0};
+};
+
+/// Append-only save file.
+///
+/// The file is a header followed by framed records, each with its length
+/// and a CRC32 of its payload. The first record is a snapshot of the whole
+/// document, every record after that is a changeset. Replay stops at the
+/// first record which is short or fails its checksum, so a torn write only
+/// ever loses the record being written
+class journal {
+public:
+    explicit journal(QString path);
+
+    /// Replay the file on disk, returns the document it describes
+    auto load() -> std::vector<stored_stroke>;
+    /// Replay data, the contents of the file on disk, a stroke at a time.
+    /// Readies the journal for append() the same as load()
+    auto read(std::string_view data) -> journal_reader;
+
+    /// Append a changeset record. Only valid after load() or compact()
+    void append(const changeset& c);
+    /// Atomically replace the file with a single snapshot record. progress
+    /// is called with how far through it is, out of 100
+    void compact(const std::vector<stored_stroke>& doc,
+                 const std::function<void(int)>& progress = {});
+    /// Encodes straight from the columns of doc
+    void compact(const document& doc,
+                 const std::function<void(int)>& progress = {});
+
+    /// Whether the changesets since the last snapshot outweigh it
+    auto needs_compaction() const -> bool;
+    void compact_ratio(double r) { compact_ratio_ = r; }
+
+    auto path() const -> const QString& { return path_; }
+    auto size() const -> std::uint64_t { return size_; }
+
+    static auto is_journal(std::string_view data) -> bool;
+    /// Replay records from data, valid_size is set to the length of the
+    /// intact prefix
+    static auto replay(std::string_view data, std::uint64_t* valid_size,
+                       std::uint64_t* snapshot_size)
+        -> std::vector<stored_stroke>;
+
+private:
+    void write_snapshot(const std::string& rec,
+                        const std::function<void(int)>& progress);
+
+    QString path_;
+    std::uint64_t size_{0};
+    std::uint64_t snapshot_size_{0};
+    double compact_ratio_{1.0};
+};
+
+namespace detail {
+auto crc32(std::string_view data, std::uint32_t crc = 0) -> std::uint32_t;
+/// c framed as a journal record, for other logs to reuse
+auto changeset_record(const changeset& c) -> std::string;
+/// Read back records written by changeset_record() up to the first which is
+/// torn, returns the length of the intact ones
+auto read_changesets(std::string_view data, std::vector<changeset>& out)
+    -> std::size_t;
+} // namespace detail
+} // namespace sketchy
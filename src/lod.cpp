@@ -0,0 +1,76 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "lod.hpp"
+
+#include "outline.hpp"
+#include "simplify.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sketchy {
+
+auto lod_level(double scale) -> int
+{
+    if (!(scale > 0)) {
+        return -1;
+    }
+    // Coarsest level whose tolerance is still within the error on screen
+    const auto level = std::floor(
+        std::log2(lod_pixel_error / (scale * lod_base_tolerance)));
+    if (level < 0) {
+        return -1;
+    }
+    return static_cast<int>(
+        std::min(level, static_cast<double>(lod_max_levels - 1)));
+}
+
+void stroke_lod::build(const stroke_view& s)
+{
+    outlines_.clear();
+    const auto size = std::max(s.bounds.width(), s.bounds.height());
+    auto points = s.to_stroke();
+    auto tolerance = lod_base_tolerance;
+    outline_builder b;
+    while (outlines_.size() != lod_max_levels && points.points.size() > 2 &&
+           tolerance < size) {
+        points = simplify(points, tolerance);
+        b.clear();
+        for (const auto& pt : points.points) {
+            b.add(pt.pos, pt.weight);
+        }
+        b.build(outlines_.emplace_back());
+        tolerance *= 2;
+    }
+}
+
+auto stroke_lod::outline(std::size_t level) const -> const QPolygonF&
+{
+    return outlines_[std::min(level, outlines_.size() - 1)];
+}
+
+auto stroke_lod::memory_usage() const -> std::size_t
+{
+    auto bytes = outlines_.capacity() * sizeof(QPolygonF);
+    for (const auto& o : outlines_) {
+        bytes += static_cast<std::size_t>(o.capacity()) * sizeof(QPointF);
+    }
+    return bytes;
+}
+
+} // namespace sketchy
@@ -0,0 +1,62 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "document.hpp"
+
+#include <qpolygon.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace sketchy {
+
+/// Tolerance of the finest level of detail, in scene units. Each level
+/// after it doubles the tolerance
+inline constexpr double lod_base_tolerance = 1;
+/// Most the level drawn may be off by, in device pixels
+inline constexpr double lod_pixel_error = 0.5;
+/// Strokes smaller than this across, in device pixels, are drawn as a dot
+inline constexpr double lod_dot_px = 1;
+inline constexpr std::size_t lod_max_levels = 16;
+
+/// Level of detail to draw at scale device pixels per scene unit, -1 for
+/// the full outline
+auto lod_level(double scale) -> int;
+
+/// Outlines of one stroke simplified at lod_base_tolerance * 2^i for level
+/// i. Each level is simplified from the one before, so building them all
+/// costs about as much as the first. Levels stop once the stroke is down to
+/// its two ends or the tolerance is bigger than the stroke, and there are
+/// none for a stroke which is that already
+class stroke_lod {
+public:
+    void build(const stroke_view& s);
+    void clear() { outlines_.clear(); }
+
+    auto levels() const -> std::size_t { return outlines_.size(); }
+    /// Levels past the coarsest are the coarsest, there must be one
+    auto outline(std::size_t level) const -> const QPolygonF&;
+
+    auto memory_usage() const -> std::size_t;
+
+private:
+    std::vector<QPolygonF> outlines_;
+};
+
+} // namespace sketchy
@@ -0,0 +1,137 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "logger.hpp"
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include <mutex>
+#include <unordered_map>
+
+namespace sketchy::logging {
+namespace {
+/// Slots in the async queue shared by every logger
+constexpr std::size_t queue_size = 8192;
+
+struct state {
+    std::mutex mx;
+    spdlog::level::level_enum fallback{spdlog::level::info};
+    std::unordered_map<std::string, spdlog::level::level_enum> levels;
+    spdlog::sink_ptr sink;
+};
+
+auto global() -> state&
+{
+    static state s;
+    return s;
+}
+
+auto trim(std::string_view s) -> std::string_view
+{
+    while (!s.empty() && s.front() == ' ') {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && s.back() == ' ') {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+auto level_of(std::string_view name) -> spdlog::level::level_enum
+{
+    return spdlog::level::from_str(std::string{name});
+}
+
+auto level_for(const state& s, const std::string& name)
+    -> spdlog::level::level_enum
+{
+    if (auto it = s.levels.find(name); it != s.levels.end()) {
+        return it->second;
+    }
+    return s.fallback;
+}
+
+/// Must be called with the state locked
+auto sink(state& s) -> spdlog::sink_ptr
+{
+    if (!s.sink) {
+        spdlog::init_thread_pool(queue_size, 1);
+        s.sink = std::make_shared<spdlog::sinks::stderr_color_sink_mt>();
+    }
+    return s.sink;
+}
+} // namespace
+
+void init(std::string_view spec)
+{
+    auto& s = global();
+    std::scoped_lock lk{s.mx};
+    while (!spec.empty()) {
+        const auto comma = spec.find(',');
+        const auto part = trim(spec.substr(0, comma));
+        spec = comma == std::string_view::npos ? std::string_view{}
+                                               : spec.substr(comma + 1);
+        if (part.empty()) {
+            continue;
+        }
+        const auto eq = part.find('=');
+        if (eq == std::string_view::npos) {
+            // from_str maps anything it doesn't know to off, so only take it
+            // when it round trips
+            const auto lvl = level_of(part);
+            if (lvl != spdlog::level::off || part == "off") {
+                s.fallback = lvl;
+            }
+            continue;
+        }
+        const auto name = std::string{trim(part.substr(0, eq))};
+        const auto value = trim(part.substr(eq + 1));
+        const auto lvl = level_of(value);
+        if (lvl != spdlog::level::off || value == "off") {
+            s.levels[name] = lvl;
+        }
+    }
+    spdlog::apply_all([&s](const logger_t& l) {
+        l->set_level(level_for(s, l->name()));
+    });
+}
+
+auto get(const std::string& name) -> logger_t
+{
+    auto& s = global();
+    std::scoped_lock lk{s.mx};
+    if (auto l = spdlog::get(name)) {
+        return l;
+    }
+    auto snk = sink(s);
+    auto l = std::make_shared<spdlog::async_logger>(
+        name, std::move(snk), spdlog::thread_pool(),
+        spdlog::async_overflow_policy::overrun_oldest);
+    l->set_level(level_for(s, name));
+    l->flush_on(spdlog::level::err);
+    spdlog::register_logger(l);
+    return l;
+}
+
+void shutdown()
+{
+    spdlog::shutdown();
+}
+
+} // namespace sketchy::logging
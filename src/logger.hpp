@@ -18,9 +18,40 @@
 #pragma once
 
 #include <spdlog/logger.h>
+#include <spdlog/spdlog.h>
+
+#include <string>
+#include <string_view>
+
+/// Trace and debug logging for hot paths. These compile to nothing when
+/// SPDLOG_ACTIVE_LEVEL is above the level (release builds default to info),
+/// so neither the arguments nor the level check cost anything there
+#define SKETCHY_TRACE(logger, ...) SPDLOG_LOGGER_TRACE(logger, __VA_ARGS__)
+#define SKETCHY_DEBUG(logger, ...) SPDLOG_LOGGER_DEBUG(logger, __VA_ARGS__)
 
 namespace sketchy {
 
 using logger_t = std::shared_ptr<spdlog::logger>;
 
-}
+namespace logging {
+
+/// Names of the per-subsystem loggers
+inline constexpr auto canvas = "canvas";
+inline constexpr auto storage = "storage";
+inline constexpr auto ui = "ui";
+
+/// Set up asynchronous logging from a level spec, which is a comma separated
+/// list of either a level for every logger or name=level for one, e.g.
+/// "info,canvas=trace". Unknown names and levels are ignored
+void init(std::string_view spec);
+
+/// The logger for a subsystem, created on first use. Messages go through a
+/// bounded ring buffer to a background thread, so logging never blocks the
+/// caller: the oldest messages are dropped if it fills
+auto get(const std::string& name) -> logger_t;
+
+/// Flush and stop the background thread
+void shutdown();
+
+} // namespace logging
+} // namespace sketchy
@@ -15,22 +15,128 @@
 // You should have received a copy of the GNU General Public License
 // along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "metrics.hpp"
+#include "ui/canvas.hpp"
+#include "ui/loader.hpp"
 #include "ui/main_window.hpp"
+#include "ui/raster_export.hpp"
 
 #include <qapplication.h>
+#include <qcommandlineparser.h>
+#include <qsavefile.h>
 
-#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 using namespace sketchy;
 
-int main(int argc, char** argv)
+namespace {
+auto export_png_to(const QString& doc, const QString& path, double dpi)
+    -> int
+{
+    const auto log = logging::get(logging::storage);
+    try {
+        QSaveFile out{path};
+        if (!out.open(QFile::WriteOnly)) {
+            throw io_error{"failed to open"};
+        }
+        ui::raster_options opts;
+        opts.dpi = dpi;
+        ui::export_png(out, ui::load_snapshot(doc), opts);
+        if (!out.commit()) {
+            throw io_error{"failed to write"};
+        }
+    }
+    catch (const std::exception& e) {
+        log->error("failed to export {} to {}: {}", doc.toStdString(),
+                   path.toStdString(), e.what());
+        return 1;
+    }
+    return 0;
+}
+
+/// Load doc into a canvas the size of a window, draw it once and print
+/// what it all costs
+auto print_memory_stats(const QString& doc) -> int
 {
-    spdlog::set_level(spdlog::level::debug);
+    const auto log = logging::get(logging::storage);
+    try {
+        ui::canvas c{logging::get(logging::canvas)};
+        c.set_strokes(ui::load_snapshot(doc).stored());
+        c.resize(1280, 800);
+        c.show();
+        QApplication::processEvents();
+        (void)c.grab();
+        std::puts(to_json(c.memory()).c_str());
+    }
+    catch (const std::exception& e) {
+        log->error("failed to load {}: {}", doc.toStdString(), e.what());
+        return 1;
+    }
+    return 0;
+}
+} // namespace
 
+int main(int argc, char** argv)
+{
+    // Exporting never shows a window, so it should not need a display
+    const auto headless = std::any_of(argv, argv + argc, [](const char* a) {
+        return std::strncmp(a, "--export-png", 12) == 0 ||
+               std::strcmp(a, "--memory-stats") == 0;
+    });
+    if (headless && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
     QApplication app{argc, argv};
 
-    ui::main_window win{spdlog::default_logger()->clone("window")};
-    win.show();
+    QCommandLineParser args;
+    args.addHelpOption();
+    const QCommandLineOption log_opt{
+        "log",
+        "Log levels, either a level for everything or name=level for one of "
+        "canvas, storage or ui. Overrides SKETCHY_LOG.",
+        "spec"};
+    const QCommandLineOption png_opt{
+        "export-png", "Render document to a PNG and exit.", "path"};
+    const QCommandLineOption dpi_opt{"dpi", "Resolution of --export-png.",
+                                     "dpi", "300"};
+    const QCommandLineOption stats_opt{
+        "memory-stats",
+        "Print what document costs in memory once drawn, as JSON, and exit."};
+    args.addOptions({log_opt, png_opt, dpi_opt, stats_opt});
+    args.addPositionalArgument("document",
+                               "Document for --export-png or --memory-stats.");
+    args.process(app);
+
+    logging::init(qEnvironmentVariable("SKETCHY_LOG").toStdString());
+    if (args.isSet(log_opt)) {
+        logging::init(args.value(log_opt).toStdString());
+    }
 
-    return app.exec();
+    auto rc = 0;
+    if (args.isSet(stats_opt)) {
+        const auto docs = args.positionalArguments();
+        if (docs.size() != 1) {
+            args.showHelp(1);
+        }
+        rc = print_memory_stats(docs.front());
+    }
+    else if (args.isSet(png_opt)) {
+        const auto docs = args.positionalArguments();
+        if (docs.size() != 1) {
+            args.showHelp(1);
+        }
+        rc = export_png_to(docs.front(), args.value(png_opt),
+                           args.value(dpi_opt).toDouble());
+    }
+    else {
+        ui::main_window win{logging::get(logging::ui)};
+        win.show();
+        rc = app.exec();
+        logging::get(logging::ui)->info("timings since startup:\n{}",
+                                        metrics::summary());
+    }
+    logging::shutdown();
+    return rc;
 }
@@ -0,0 +1,140 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "memory_stats.hpp"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <utility>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace sketchy {
+
+namespace {
+auto components(const memory_stats& m)
+    -> std::array<std::pair<const char*, std::size_t>, 8>
+{
+    return {{
+        {"points", m.point_bytes},
+        {"strokes", m.stroke_bytes},
+        {"palette", m.palette_bytes},
+        {"items", m.item_bytes},
+        {"outlines", m.outline_bytes},
+        {"lod", m.lod_bytes},
+        {"id_map", m.id_map_bytes},
+        {"ink_tiles", m.ink_tile_bytes},
+    }};
+}
+
+auto per(std::size_t bytes, std::size_t n, double scale = 1) -> double
+{
+    return n == 0 ? 0 : static_cast<double>(bytes) * scale /
+                            static_cast<double>(n);
+}
+
+auto mib(std::size_t bytes) -> double
+{
+    return static_cast<double>(bytes) / (1024 * 1024);
+}
+} // namespace
+
+auto read_heap_stats() -> heap_stats
+{
+    heap_stats h;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    const auto i = mallinfo2();
+    h.known = true;
+    h.arena = i.arena;
+    h.mapped = i.hblkhd;
+    h.in_use = i.uordblks + i.hblkhd;
+    h.free = i.fordblks;
+#endif
+    return h;
+}
+
+auto memory_stats::total_bytes() const -> std::size_t
+{
+    std::size_t bytes = 0;
+    for (const auto& [name, b] : components(*this)) {
+        bytes += b;
+    }
+    return bytes;
+}
+
+auto to_json(const memory_stats& m) -> std::string
+{
+    auto out = fmt::format(
+        R"({{"strokes":{},"points":{},"segments":{},"items":{},)"
+        R"("item_slots":{},"outlines":{},"lod_levels":{},)"
+        R"("point_blocks":{},"removed_point_bytes":{},)"
+        R"("scene":{{"items":{},"indexed":{},"depth":{}}},)"
+        R"("caches":{{"ink_tiles":{},"resident_tiles":{},)"
+        R"("resident_bytes":{}}},)"
+        R"("total_bytes":{},"bytes_per_segment":{:.2f},)"
+        R"("bytes_per_1k_points":{:.1f},"components":{{)",
+        m.strokes, m.points, m.segments(), m.items, m.item_slots, m.outlines,
+        m.lod_levels, m.point_blocks, m.removed_point_bytes, m.scene_items,
+        m.scene_indexed, m.scene_index_depth, m.ink_tiles, m.resident_tiles,
+        m.resident_bytes, m.total_bytes(), per(m.total_bytes(), m.segments()),
+        per(m.total_bytes(), m.points, 1000));
+    auto first = true;
+    for (const auto& [name, bytes] : components(m)) {
+        out += fmt::format(
+            R"({}"{}":{{"bytes":{},"per_segment":{:.2f},)"
+            R"("per_1k_points":{:.1f}}})",
+            first ? "" : ",", name, bytes, per(bytes, m.segments()),
+            per(bytes, m.points, 1000));
+        first = false;
+    }
+    out += "}";
+    if (m.heap.known) {
+        out += fmt::format(
+            R"(,"heap":{{"arena":{},"mapped":{},"in_use":{},"free":{}}})",
+            m.heap.arena, m.heap.mapped, m.heap.in_use, m.heap.free);
+    }
+    return out + "}";
+}
+
+auto to_text(const memory_stats& m) -> std::string
+{
+    auto out = fmt::format(
+        "{} strokes, {} points, {} items ({} slots)\n"
+        "{:.1f} MiB counted, {:.1f} B/segment, {:.1f} KiB/1k points\n"
+        "points {:.1f} MiB, outlines {:.1f} MiB ({}), lod {:.1f} MiB ({})\n"
+        "ink tiles {} ({:.1f} MiB), scene {} items, index {}",
+        m.strokes, m.points, m.items, m.item_slots, mib(m.total_bytes()),
+        per(m.total_bytes(), m.segments()),
+        per(m.total_bytes(), m.points, 1000) / 1024, mib(m.point_bytes),
+        mib(m.outline_bytes), m.outlines, mib(m.lod_bytes), m.lod_levels,
+        m.ink_tiles, mib(m.ink_tile_bytes), m.scene_items,
+        m.scene_indexed ? "bsp" : "none");
+    if (m.resident_tiles != 0) {
+        out += fmt::format("\nresident tiles {} ({:.1f} MiB)",
+                           m.resident_tiles, mib(m.resident_bytes));
+    }
+    if (m.heap.known) {
+        out += fmt::format("\nheap {:.1f} MiB in use, {:.1f} MiB free",
+                           mib(m.heap.in_use), mib(m.heap.free));
+    }
+    return out;
+}
+
+} // namespace sketchy
@@ -0,0 +1,94 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace sketchy {
+
+/// What the allocator holds, where it can be asked
+struct heap_stats {
+    bool known{false};
+    /// Taken from the system, in the main arena and mapped separately
+    std::size_t arena{0};
+    std::size_t mapped{0};
+    /// Handed out and not freed
+    std::size_t in_use{0};
+    /// Held but free, fragmentation and slack
+    std::size_t free{0};
+};
+
+/// Allocator statistics from glibc's mallinfo2(), unknown elsewhere
+auto read_heap_stats() -> heap_stats;
+
+/// Memory and object counts for a canvas and its document. Bytes are heap
+/// bytes held, capacity rather than size
+struct memory_stats {
+    std::size_t strokes{0};
+    std::size_t points{0};
+
+    /// Document: the point columns, the per-stroke columns and the colours
+    std::size_t point_bytes{0};
+    std::size_t stroke_bytes{0};
+    std::size_t palette_bytes{0};
+    /// Part of point_bytes still held by removed strokes
+    std::size_t removed_point_bytes{0};
+    std::size_t point_blocks{0};
+
+    /// Scene items, the arena slots they live in and what they cache
+    std::size_t items{0};
+    std::size_t item_slots{0};
+    std::size_t item_bytes{0};
+    std::size_t outlines{0};
+    std::size_t outline_bytes{0};
+    std::size_t lod_levels{0};
+    std::size_t lod_bytes{0};
+    /// Looking items up by stroke id
+    std::size_t id_map_bytes{0};
+
+    std::size_t scene_items{0};
+    bool scene_indexed{false};
+    /// 0 while Qt picks the depth
+    int scene_index_depth{0};
+
+    std::size_t ink_tiles{0};
+    std::size_t ink_tile_bytes{0};
+    /// Notebook tiles paged in, and what they are charged against the
+    /// budget. An estimate of the items in them, so not in the total
+    std::size_t resident_tiles{0};
+    std::size_t resident_bytes{0};
+
+    heap_stats heap;
+
+    /// Everything counted above, not the heap, which includes it
+    auto total_bytes() const -> std::size_t;
+    /// Segments are what is drawn between two points
+    auto segments() const -> std::size_t
+    {
+        return points > strokes ? points - strokes : 0;
+    }
+};
+
+/// One object, each component with its bytes, bytes per segment and bytes
+/// per 1k points so documents of any size compare
+auto to_json(const memory_stats& m) -> std::string;
+/// A few short lines for an overlay
+auto to_text(const memory_stats& m) -> std::string;
+
+} // namespace sketchy
@@ -0,0 +1,172 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "metrics.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace sketchy {
+
+namespace {
+std::array<histogram, metrics::timing_count> timings;
+std::array<std::atomic<std::uint64_t>, metrics::counter_count> counters{};
+
+constexpr std::array<std::string_view, metrics::timing_count> timing_names{
+    "paint", "input", "delivery", "event_to_frame", "erase", "save"};
+constexpr std::array<std::string_view, metrics::counter_count>
+    counter_names{"events", "dropped_samples", "batches"};
+
+auto ms(std::uint64_t us) -> double { return static_cast<double>(us) / 1000; }
+} // namespace
+
+void histogram::record(std::uint64_t us) noexcept
+{
+    us = std::min(us, max_us);
+    counts_[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(us, std::memory_order_relaxed);
+    auto seen = max_.load(std::memory_order_relaxed);
+    while (us > seen &&
+           !max_.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {
+    }
+}
+
+void histogram::reset() noexcept
+{
+    for (auto& c : counts_) {
+        c.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+auto histogram::mean() const noexcept -> double
+{
+    const auto n = count();
+    return n == 0 ? 0
+                  : static_cast<double>(sum_.load(std::memory_order_relaxed)) /
+                        static_cast<double>(n);
+}
+
+auto histogram::percentile(double q) const noexcept -> std::uint64_t
+{
+    const auto n = count();
+    if (n == 0) {
+        return 0;
+    }
+    const auto rank = std::max<std::uint64_t>(
+        1, static_cast<std::uint64_t>(
+               std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(n))));
+    std::uint64_t seen = 0;
+    for (std::size_t b = 0; b != buckets; ++b) {
+        seen += counts_[b].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(bucket_top(b), max());
+        }
+    }
+    return max();
+}
+
+auto histogram::bucket_of(std::uint64_t us) noexcept -> std::size_t
+{
+    if (us < sub_buckets) {
+        return static_cast<std::size_t>(us);
+    }
+    // The top sub_bits + 1 bits pick the bucket, the rest are dropped
+    const auto shift = static_cast<std::size_t>(std::bit_width(us)) -
+                       sub_bits - 1;
+    return (shift + 1) * sub_buckets +
+           static_cast<std::size_t>((us >> shift) - sub_buckets);
+}
+
+auto histogram::bucket_top(std::size_t b) noexcept -> std::uint64_t
+{
+    if (b < sub_buckets) {
+        return b;
+    }
+    const auto shift = b / sub_buckets - 1;
+    const auto sub = b % sub_buckets + sub_buckets;
+    return ((static_cast<std::uint64_t>(sub) + 1) << shift) - 1;
+}
+
+namespace metrics {
+
+auto get(timing t) -> histogram&
+{
+    return timings[static_cast<std::size_t>(t)];
+}
+auto name(timing t) -> std::string_view
+{
+    return timing_names[static_cast<std::size_t>(t)];
+}
+
+void add(counter c, std::uint64_t n) noexcept
+{
+    counters[static_cast<std::size_t>(c)].fetch_add(
+        n, std::memory_order_relaxed);
+}
+auto value(counter c) -> std::uint64_t
+{
+    return counters[static_cast<std::size_t>(c)].load(
+        std::memory_order_relaxed);
+}
+auto name(counter c) -> std::string_view
+{
+    return counter_names[static_cast<std::size_t>(c)];
+}
+
+auto summary() -> std::string
+{
+    std::string out;
+    for (std::size_t i = 0; i != timing_count; ++i) {
+        const auto& h = timings[i];
+        out += fmt::format(
+            "{:<14} n={:<8} p50={:.2f}ms p99={:.2f}ms max={:.2f}ms\n",
+            timing_names[i], h.count(), ms(h.percentile(0.5)),
+            ms(h.percentile(0.99)), ms(h.max()));
+    }
+    for (std::size_t i = 0; i != counter_count; ++i) {
+        out += fmt::format("{}{}={}", i == 0 ? "" : " ", counter_names[i],
+                           counters[i].load(std::memory_order_relaxed));
+    }
+    return out;
+}
+
+void reset()
+{
+    for (auto& h : timings) {
+        h.reset();
+    }
+    for (auto& c : counters) {
+        c.store(0, std::memory_order_relaxed);
+    }
+}
+
+scoped_timer::~scoped_timer()
+{
+    const auto took = std::chrono::steady_clock::now() - start_;
+    to_->record(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(took).count()));
+}
+
+} // namespace metrics
+} // namespace sketchy
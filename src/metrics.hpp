@@ -0,0 +1,126 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace sketchy {
+
+/// Log-linear histogram of durations in microseconds, like HdrHistogram:
+/// exact below 2^sub_bits, then 2^sub_bits buckets per power of two, so a
+/// value is within about 3% of the top of its bucket. Recording is a few
+/// relaxed atomic adds, lock-free and safe from any thread. Reading while
+/// another thread records may see a sample in some totals and not others
+class histogram {
+public:
+    static constexpr int sub_bits = 5;
+    /// Longer durations are counted as this, about 19 hours
+    static constexpr std::uint64_t max_us = (std::uint64_t{1} << 36) - 1;
+
+    void record(std::uint64_t us) noexcept;
+    void reset() noexcept;
+
+    auto count() const noexcept -> std::uint64_t
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+    auto max() const noexcept -> std::uint64_t
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
+    auto mean() const noexcept -> double;
+    /// Top of the bucket holding the sample q of the way up, capped at the
+    /// largest recorded. 0 when empty
+    auto percentile(double q) const noexcept -> std::uint64_t;
+
+    static auto bucket_of(std::uint64_t us) noexcept -> std::size_t;
+    /// Largest value which lands in bucket b
+    static auto bucket_top(std::size_t b) noexcept -> std::uint64_t;
+
+private:
+    static constexpr std::size_t sub_buckets = std::size_t{1} << sub_bits;
+    static constexpr std::size_t buckets = (36 - sub_bits + 1) * sub_buckets;
+
+    std::array<std::atomic<std::uint64_t>, buckets> counts_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+namespace metrics {
+
+/// Durations timed all the time. delivery is how much later than usual an
+/// input event reached the app after its timestamp, event_to_frame is from
+/// then until a frame showing it was painted, so a driver stall shows in
+/// the first and a rendering stall in the second
+enum class timing {
+    paint,
+    input,
+    delivery,
+    event_to_frame,
+    erase,
+    save,
+};
+inline constexpr std::size_t timing_count = 6;
+
+enum class counter {
+    /// Pointer events handled
+    events,
+    /// Pen moves dropped as too close to the last one
+    dropped_samples,
+    /// Batches of pen moves added to the live stroke
+    batches,
+};
+inline constexpr std::size_t counter_count = 3;
+
+auto get(timing t) -> histogram&;
+auto name(timing t) -> std::string_view;
+
+void add(counter c, std::uint64_t n = 1) noexcept;
+auto value(counter c) -> std::uint64_t;
+auto name(counter c) -> std::string_view;
+
+/// A line of count, p50, p99 and max per timing, then the counters
+auto summary() -> std::string;
+/// Zero every timing and counter
+void reset();
+
+/// Records the time from construction to destruction
+class scoped_timer {
+public:
+    explicit scoped_timer(timing t)
+        : to_{&get(t)}, start_{std::chrono::steady_clock::now()}
+    {
+    }
+    scoped_timer(const scoped_timer&) = delete;
+    auto operator=(const scoped_timer&) -> scoped_timer& = delete;
+    ~scoped_timer();
+
+private:
+    histogram* to_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace metrics
+} // namespace sketchy
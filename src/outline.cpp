@@ -0,0 +1,168 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "outline.hpp"
+
+#include <cmath>
+#include <numbers>
+
+namespace sketchy {
+
+namespace {
+constexpr auto cap_step = std::numbers::pi / outline_cap_segments;
+
+auto direction(const QPointF& from, const QPointF& to) -> QPointF
+{
+    const auto d = to - from;
+    return d / std::hypot(d.x(), d.y());
+}
+/// Left of direction d
+auto normal(const QPointF& d) -> QPointF
+{
+    return {-d.y(), d.x()};
+}
+auto rotate(const QPointF& v, double a) -> QPointF
+{
+    const auto c = std::cos(a);
+    const auto s = std::sin(a);
+    return {v.x() * c - v.y() * s, v.x() * s + v.y() * c};
+}
+/// Half turn around centre from centre + from to centre - from, passing
+/// centre + ahead. Both ends are left out
+void half_turn(QPolygonF& out, const QPointF& centre, const QPointF& from,
+               const QPointF& ahead)
+{
+    for (int i = 1; i < outline_cap_segments; ++i) {
+        const auto a = cap_step * i;
+        out.append(centre + from * std::cos(a) + ahead * std::sin(a));
+    }
+}
+} // namespace
+
+void outline_builder::clear()
+{
+    pos_.clear();
+    radius_.clear();
+    left_.clear();
+    right_.clear();
+    left_from_.clear();
+    right_from_.clear();
+}
+
+void outline_builder::add(const QPointF& pos, double weight)
+{
+    if (!pos_.empty() && pos_.back() == pos) {
+        return;
+    }
+    pos_.push_back(pos);
+    radius_.push_back(weight / 2);
+    const auto n = pos_.size();
+    if (n >= 2) {
+        // Was an end and is now a join
+        left_.resize(left_from_.back());
+        right_.resize(right_from_.back());
+        sides(n - 2);
+    }
+    left_from_.push_back(left_.size());
+    right_from_.push_back(right_.size());
+    sides(n - 1);
+}
+
+void outline_builder::sides(std::size_t i)
+{
+    const auto p = pos_[i];
+    const auto r = radius_[i];
+    const auto last = pos_.size() - 1;
+    if (i == 0 || i == last) {
+        if (last == 0) {
+            // Drawn as a circle by build()
+            return;
+        }
+        const auto n = normal(i == 0 ? direction(p, pos_[1])
+                                     : direction(pos_[i - 1], p)) *
+                       r;
+        left_.push_back(p + n);
+        right_.push_back(p - n);
+        return;
+    }
+    const auto in = direction(pos_[i - 1], p);
+    const auto out = direction(p, pos_[i + 1]);
+    const auto turn = std::atan2(in.x() * out.y() - in.y() * out.x(),
+                                 in.x() * out.x() + in.y() * out.y());
+    const auto n_in = normal(in);
+    if (std::abs(turn) <= cap_step) {
+        // Gentle enough that the two normals can be averaged
+        const auto n = rotate(n_in, turn / 2) * r;
+        left_.push_back(p + n);
+        right_.push_back(p - n);
+        return;
+    }
+    // Round on the outside, a single point on the inside. A positive turn
+    // is towards the left
+    const auto steps = static_cast<int>(std::ceil(std::abs(turn) / cap_step));
+    auto& outer = turn > 0 ? right_ : left_;
+    auto& inner = turn > 0 ? left_ : right_;
+    const auto sign = turn > 0 ? -r : r;
+    for (int s = 0; s <= steps; ++s) {
+        outer.push_back(p + rotate(n_in, turn * s / steps) * sign);
+    }
+    inner.push_back(p - rotate(n_in, turn / 2) * sign);
+}
+
+void outline_builder::build(QPolygonF& out) const
+{
+    out.clear();
+    if (pos_.empty()) {
+        return;
+    }
+    const auto first = pos_.front();
+    const auto last = pos_.back();
+    if (pos_.size() == 1) {
+        const auto r = radius_.front();
+        out.reserve(2 * outline_cap_segments);
+        for (int i = 0; i < 2 * outline_cap_segments; ++i) {
+            const auto a = cap_step * i;
+            out.append(first + QPointF{std::cos(a), std::sin(a)} * r);
+        }
+        return;
+    }
+    out.reserve(static_cast<qsizetype>(left_.size() + right_.size() +
+                                       2 * outline_cap_segments));
+    for (const auto& pt : left_) {
+        out.append(pt);
+    }
+    const auto end = direction(pos_[pos_.size() - 2], last) * radius_.back();
+    half_turn(out, last, normal(end), end);
+    for (auto it = right_.rbegin(); it != right_.rend(); ++it) {
+        out.append(*it);
+    }
+    const auto start = direction(first, pos_[1]) * radius_.front();
+    half_turn(out, first, -normal(start), -start);
+}
+
+void stroke_outline(const stroke_view& s, QPolygonF& out)
+{
+    thread_local outline_builder b;
+    b.clear();
+    for (std::size_t i = 0; i != s.size(); ++i) {
+        b.add(s.point(i).pos, s.ws[i]);
+    }
+    b.build(out);
+}
+
+} // namespace sketchy
@@ -0,0 +1,68 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "document.hpp"
+
+#include <qpolygon.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace sketchy {
+
+/// Points in each round end of an outline, and the most in a round join
+inline constexpr int outline_cap_segments = 8;
+
+/// Builds the filled outline of a stroke whose width follows the weight at
+/// each point, with round ends. Turns sharper than a cap segment get a round
+/// join on the outside. Every point of the outline is within half a weight
+/// of the point it came from, so it stays inside the stroke's bounds.
+///
+/// The sides at a point only depend on the points either side of it, so
+/// adding a point redoes the last two and leaves the rest. Fill with
+/// Qt::WindingFill, since a tight curve can make the outline cross itself
+class outline_builder {
+public:
+    void clear();
+    /// Repeats of the last position are skipped
+    void add(const QPointF& pos, double weight);
+    /// Replace out with the whole outline, ends included
+    void build(QPolygonF& out) const;
+
+    auto empty() const -> bool { return pos_.empty(); }
+
+private:
+    /// Redo the sides at point i
+    void sides(std::size_t i);
+
+    std::vector<QPointF> pos_;
+    std::vector<double> radius_;
+    /// Both sides run from the first point to the last
+    std::vector<QPointF> left_;
+    std::vector<QPointF> right_;
+    /// Where each point's part of the sides begins
+    std::vector<std::size_t> left_from_;
+    std::vector<std::size_t> right_from_;
+};
+
+/// Replace out with the outline of s
+void stroke_outline(const stroke_view& s, QPolygonF& out);
+
+} // namespace sketchy
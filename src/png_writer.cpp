@@ -0,0 +1,142 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "png_writer.hpp"
+#include "storage.hpp"
+
+#include <qiodevice.h>
+
+#include <zlib.h>
+
+#include <array>
+#include <cmath>
+
+namespace sketchy {
+namespace {
+/// IDAT chunks are written once this much compressed data is waiting
+constexpr std::size_t idat_size = 256 * 1024;
+
+void put_u32(std::string& out, std::uint32_t v)
+{
+    out += static_cast<char>(v >> 24);
+    out += static_cast<char>(v >> 16);
+    out += static_cast<char>(v >> 8);
+    out += static_cast<char>(v);
+}
+} // namespace
+
+struct png_writer::deflater {
+    z_stream s{};
+};
+
+png_writer::png_writer(QIODevice& out, std::uint32_t width,
+                       std::uint32_t height, double dpi)
+    : out_{out},
+      width_{width},
+      height_{height},
+      z_{std::make_unique<deflater>()}
+{
+    if (deflateInit(&z_->s, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        throw io_error{"failed to start deflate"};
+    }
+    constexpr std::array<char, 8> signature{'\x89', 'P',    'N',  'G',
+                                            '\r',   '\n', '\x1a', '\n'};
+    if (out_.write(signature.data(), signature.size()) !=
+        static_cast<qint64>(signature.size())) {
+        throw io_error{"failed to write png"};
+    }
+    std::string ihdr;
+    put_u32(ihdr, width);
+    put_u32(ihdr, height);
+    // 8 bits, truecolour, deflate, adaptive filtering, no interlace
+    ihdr += std::string{"\x08\x02\x00\x00\x00", 5};
+    chunk("IHDR", ihdr);
+    if (dpi > 0) {
+        const auto per_metre =
+            static_cast<std::uint32_t>(std::lround(dpi / 0.0254));
+        std::string phys;
+        put_u32(phys, per_metre);
+        put_u32(phys, per_metre);
+        phys += '\x01';
+        chunk("pHYs", phys);
+    }
+}
+
+png_writer::~png_writer() { deflateEnd(&z_->s); }
+
+void png_writer::chunk(const char* type, const std::string& data)
+{
+    std::string out;
+    out.reserve(data.size() + 12);
+    put_u32(out, static_cast<std::uint32_t>(data.size()));
+    out.append(type, 4);
+    out += data;
+    auto crc = ::crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+    crc = ::crc32(crc, reinterpret_cast<const Bytef*>(data.data()),
+                  static_cast<uInt>(data.size()));
+    put_u32(out, static_cast<std::uint32_t>(crc));
+    if (out_.write(out.data(), static_cast<qint64>(out.size())) !=
+        static_cast<qint64>(out.size())) {
+        throw io_error{"failed to write png"};
+    }
+}
+
+void png_writer::deflate(const std::uint8_t* data, std::size_t size,
+                         int flush)
+{
+    std::array<std::uint8_t, 64 * 1024> buf{};
+    auto& s = z_->s;
+    s.next_in = const_cast<Bytef*>(data);
+    s.avail_in = static_cast<uInt>(size);
+    do {
+        s.next_out = buf.data();
+        s.avail_out = static_cast<uInt>(buf.size());
+        if (::deflate(&s, flush) == Z_STREAM_ERROR) {
+            throw io_error{"failed to deflate png"};
+        }
+        pending_.append(reinterpret_cast<const char*>(buf.data()),
+                        buf.size() - s.avail_out);
+    } while (s.avail_out == 0);
+    if (pending_.size() >= idat_size || flush == Z_FINISH) {
+        chunk("IDAT", pending_);
+        pending_.clear();
+    }
+}
+
+void png_writer::write_row(const std::uint8_t* rgb)
+{
+    if (rows_ == height_) {
+        throw io_error{"too many png rows"};
+    }
+    // Filter type none, the white space around ink deflates well anyway
+    constexpr std::uint8_t filter = 0;
+    deflate(&filter, 1, Z_NO_FLUSH);
+    deflate(rgb, std::size_t{width_} * 3, Z_NO_FLUSH);
+    ++rows_;
+}
+
+void png_writer::finish()
+{
+    if (rows_ != height_) {
+        throw io_error{"png is missing rows"};
+    }
+    deflate(nullptr, 0, Z_FINISH);
+    chunk("IEND", {});
+}
+
+} // namespace sketchy
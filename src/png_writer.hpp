@@ -0,0 +1,60 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class QIODevice;
+
+namespace sketchy {
+
+/// Writes an 8-bit RGB PNG a row at a time. Rows are deflated as they come
+/// in and flushed as IDAT chunks, so only the compressor's window and one
+/// chunk are ever buffered
+class png_writer {
+public:
+    png_writer(QIODevice& out, std::uint32_t width, std::uint32_t height,
+               double dpi = 0);
+    ~png_writer();
+    png_writer(const png_writer&) = delete;
+    auto operator=(const png_writer&) -> png_writer& = delete;
+
+    /// width * 3 bytes of RGB
+    void write_row(const std::uint8_t* rgb);
+    /// Must be called after the last row
+    void finish();
+
+    auto rows_written() const -> std::uint32_t { return rows_; }
+
+private:
+    struct deflater;
+
+    void chunk(const char* type, const std::string& data);
+    void deflate(const std::uint8_t* data, std::size_t size, int flush);
+
+    QIODevice& out_;
+    std::uint32_t width_;
+    std::uint32_t height_;
+    std::uint32_t rows_{0};
+    std::unique_ptr<deflater> z_;
+    std::string pending_;
+};
+
+} // namespace sketchy
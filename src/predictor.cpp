@@ -0,0 +1,204 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "predictor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace sketchy {
+namespace {
+/// Samples older than this are left out of the fit, in milliseconds
+constexpr double fit_window_ms = 50;
+constexpr std::size_t max_fit_samples = 8;
+/// Points in a predicted tail
+constexpr int predict_steps = 3;
+/// The predicted move is at most this much further than the current
+/// velocity alone would go
+constexpr double max_overshoot = 1.5;
+/// Slower than this, in scene units per millisecond, is not moving
+constexpr double min_speed = 1e-3;
+
+/// Least squares polynomial in t of up to degree 2 through (ts, ys), as
+/// coefficients of 1, t and t^2. Degree drops to 1 for fewer than three
+/// samples and the fit fails for fewer than two distinct times
+class fit {
+public:
+    explicit fit(const std::vector<double>& ts)
+    {
+        for (const auto t : ts) {
+            auto p = 1.0;
+            for (auto& s : sums_) {
+                s += p;
+                p *= t;
+            }
+        }
+        quadratic_ = ts.size() >= 3 && det3() > 1e-9;
+        ok_ = quadratic_ || det2() > 1e-9;
+    }
+    auto ok() const -> bool { return ok_; }
+
+    auto solve(const std::vector<double>& ts,
+               const std::vector<double>& ys) const -> std::array<double, 3>
+    {
+        std::array<double, 3> r{};
+        for (std::size_t i = 0; i != ts.size(); ++i) {
+            r[0] += ys[i];
+            r[1] += ys[i] * ts[i];
+            r[2] += ys[i] * ts[i] * ts[i];
+        }
+        const auto& s = sums_;
+        if (!quadratic_) {
+            const auto d = det2();
+            return {(r[0] * s[2] - r[1] * s[1]) / d,
+                    (s[0] * r[1] - s[1] * r[0]) / d, 0};
+        }
+        // Cramer's rule over the normal equations
+        const auto d = det3();
+        const auto det = [](const std::array<double, 3>& c0,
+                            const std::array<double, 3>& c1,
+                            const std::array<double, 3>& c2) {
+            return c0[0] * (c1[1] * c2[2] - c2[1] * c1[2]) -
+                   c1[0] * (c0[1] * c2[2] - c2[1] * c0[2]) +
+                   c2[0] * (c0[1] * c1[2] - c1[1] * c0[2]);
+        };
+        const std::array c0{s[0], s[1], s[2]};
+        const std::array c1{s[1], s[2], s[3]};
+        const std::array c2{s[2], s[3], s[4]};
+        return {det(r, c1, c2) / d, det(c0, r, c2) / d, det(c0, c1, r) / d};
+    }
+
+private:
+    auto det2() const -> double
+    {
+        return sums_[0] * sums_[2] - sums_[1] * sums_[1];
+    }
+    auto det3() const -> double
+    {
+        const auto& s = sums_;
+        return s[0] * (s[2] * s[4] - s[3] * s[3]) -
+               s[1] * (s[1] * s[4] - s[3] * s[2]) +
+               s[2] * (s[1] * s[3] - s[2] * s[2]);
+    }
+
+    /// Sums of t^0 to t^4
+    std::array<double, 5> sums_{};
+    bool quadratic_{false};
+    bool ok_{false};
+};
+
+auto at(const std::array<double, 3>& c, double t) -> double
+{
+    return c[0] + c[1] * t + c[2] * t * t;
+}
+} // namespace
+
+void pen_predictor::reset()
+{
+    samples_.clear();
+    pending_.clear();
+}
+
+void pen_predictor::add(double t, const detail::stroke::point& pt)
+{
+    if (!samples_.empty() && t < samples_.back().t) {
+        // Timestamps from somewhere else, nothing before can be compared
+        reset();
+    }
+    while (!pending_.empty() && t >= pending_.front().t) {
+        // Where the pen was at the predicted time, going by the samples
+        // either side of it
+        const auto& p = pending_.front();
+        const auto& prev = samples_.back();
+        const auto span = t - prev.t;
+        const auto f =
+            span > 0 ? std::clamp((p.t - prev.t) / span, 0.0, 1.0) : 1.0;
+        const auto d = p.pos - (prev.pt.pos + (pt.pos - prev.pt.pos) * f);
+        const auto error = std::hypot(d.x(), d.y());
+        ++stats_.checked;
+        stats_.error_sum += error;
+        if (error <= predict_tolerance) {
+            ++stats_.hits;
+            stats_.hidden_ms += p.horizon;
+        }
+        pending_.pop_front();
+    }
+    samples_.push_back({t, pt});
+    while (samples_.size() > max_fit_samples ||
+           t - samples_.front().t > fit_window_ms) {
+        samples_.pop_front();
+    }
+}
+
+void pen_predictor::predict(double horizon,
+                            std::vector<detail::stroke::point>& out)
+{
+    out.clear();
+    if (samples_.size() < 2 || horizon <= 0) {
+        return;
+    }
+    const auto& last = samples_.back();
+    thread_local std::vector<double> ts;
+    thread_local std::vector<double> xs;
+    thread_local std::vector<double> ys;
+    thread_local std::vector<double> ws;
+    ts.clear();
+    xs.clear();
+    ys.clear();
+    ws.clear();
+    auto min_w = last.pt.weight;
+    auto max_w = last.pt.weight;
+    for (const auto& s : samples_) {
+        // Relative to the last sample so the sums stay small
+        ts.push_back(s.t - last.t);
+        xs.push_back(s.pt.pos.x());
+        ys.push_back(s.pt.pos.y());
+        ws.push_back(s.pt.weight);
+        min_w = std::min(min_w, s.pt.weight);
+        max_w = std::max(max_w, s.pt.weight);
+    }
+    const fit f{ts};
+    if (!f.ok()) {
+        return;
+    }
+    const auto cx = f.solve(ts, xs);
+    const auto cy = f.solve(ts, ys);
+    const auto cw = f.solve(ts, ws);
+    const auto speed = std::hypot(cx[1], cy[1]);
+    if (speed < min_speed) {
+        return;
+    }
+    // Offsets from the fit at the last sample, so the tail starts exactly
+    // where the ink ends
+    const auto limit = speed * horizon * max_overshoot;
+    for (int i = 1; i <= predict_steps; ++i) {
+        const auto h = horizon * i / predict_steps;
+        QPointF d{at(cx, h) - cx[0], at(cy, h) - cy[0]};
+        if (const auto len = std::hypot(d.x(), d.y()); len > limit) {
+            d *= limit / len;
+        }
+        const auto w = std::clamp(
+            static_cast<float>(last.pt.weight + at(cw, h) - cw[0]), min_w,
+            max_w);
+        out.push_back({last.pt.pos + d, w});
+    }
+    pending_.push_back({last.t + horizon, out.back().pos, horizon});
+}
+
+} // namespace sketchy
@@ -0,0 +1,102 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "storage.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+namespace sketchy {
+
+/// How far ahead of the last pen sample ink is predicted, in milliseconds.
+/// About a frame, which is most of what the pen is ahead of the ink
+inline constexpr double predict_horizon_ms = 16;
+/// A prediction this close to where the pen went counts as hiding the
+/// latency it covered, in scene units
+inline constexpr double predict_tolerance = 2;
+
+/// How well predictions matched where the pen actually went
+struct prediction_stats {
+    /// Predictions whose time has come and were compared with the pen
+    std::size_t checked{0};
+    /// Of those, how many were within predict_tolerance
+    std::size_t hits{0};
+    double error_sum{0};
+    /// Horizon of every hit, summed
+    double hidden_ms{0};
+
+    auto mean_error() const -> double
+    {
+        return checked == 0 ? 0 : error_sum / static_cast<double>(checked);
+    }
+    /// How much sooner ink appears where the pen is, on average. A miss
+    /// hides nothing
+    auto hidden_latency_ms() const -> double
+    {
+        return checked == 0 ? 0 : hidden_ms / static_cast<double>(checked);
+    }
+    void merge(const prediction_stats& s)
+    {
+        checked += s.checked;
+        hits += s.hits;
+        error_sum += s.error_sum;
+        hidden_ms += s.hidden_ms;
+    }
+};
+
+/// Extrapolates where the pen is going from its recent samples. Position
+/// and weight are each fitted with a least squares quadratic in time over
+/// the last few samples, and the predicted move is capped so a sudden turn
+/// cannot fling the ink far past where the pen was heading
+class pen_predictor {
+public:
+    /// Forget the samples, for the start of a stroke. Stats are kept
+    void reset();
+    /// t is in milliseconds, from any fixed point
+    void add(double t, const detail::stroke::point& pt);
+    /// Replace out with where the pen should be over the next horizon
+    /// milliseconds, empty if there is not enough to go on or it is still
+    void predict(double horizon, std::vector<detail::stroke::point>& out);
+
+    auto stats() const -> const prediction_stats& { return stats_; }
+    void clear_stats() { stats_ = {}; }
+
+private:
+    struct sample {
+        double t;
+        detail::stroke::point pt;
+    };
+    /// Prediction for a time still to come, checked once a sample is past
+    /// it
+    struct pending {
+        double t;
+        QPointF pos;
+        double horizon;
+    };
+
+    std::deque<sample> samples_;
+    /// Oldest first, several are in flight when samples come faster than
+    /// the horizon
+    std::deque<pending> pending_;
+    prediction_stats stats_;
+};
+
+} // namespace sketchy
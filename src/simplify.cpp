@@ -0,0 +1,97 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "simplify.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace sketchy {
+namespace {
+/// Squared distance from p to the segment a-b, with weight as the third axis
+auto distance2(const detail::stroke::point& p, const detail::stroke::point& a,
+               const detail::stroke::point& b, double k) -> double
+{
+    const auto ax = a.pos.x();
+    const auto ay = a.pos.y();
+    const auto aw = a.weight * k;
+    const auto dx = b.pos.x() - ax;
+    const auto dy = b.pos.y() - ay;
+    const auto dw = b.weight * k - aw;
+    const auto px = p.pos.x() - ax;
+    const auto py = p.pos.y() - ay;
+    const auto pw = p.weight * k - aw;
+    const auto len2 = dx * dx + dy * dy + dw * dw;
+    const auto t =
+        len2 > 0 ? std::clamp((px * dx + py * dy + pw * dw) / len2, 0.0, 1.0)
+                 : 0.0;
+    const auto ex = px - t * dx;
+    const auto ey = py - t * dy;
+    const auto ew = pw - t * dw;
+    return ex * ex + ey * ey + ew * ew;
+}
+} // namespace
+
+auto simplify(const detail::stroke& s, double tolerance, double weight_scale)
+    -> detail::stroke
+{
+    const auto& pts = s.points;
+    if (pts.size() < 3 || tolerance <= 0) {
+        return s;
+    }
+    const auto tol2 = tolerance * tolerance;
+    std::vector<bool> keep(pts.size(), false);
+    keep.front() = true;
+    keep.back() = true;
+
+    // Explicit stack, a long stroke can be thousands of samples
+    std::vector<std::pair<std::size_t, std::size_t>> todo{
+        {0, pts.size() - 1}};
+    while (!todo.empty()) {
+        const auto [first, last] = todo.back();
+        todo.pop_back();
+        auto worst = first;
+        auto worst_d2 = tol2;
+        for (auto i = first + 1; i < last; ++i) {
+            const auto d2 =
+                distance2(pts[i], pts[first], pts[last], weight_scale);
+            if (d2 > worst_d2) {
+                worst = i;
+                worst_d2 = d2;
+            }
+        }
+        if (worst != first) {
+            keep[worst] = true;
+            todo.emplace_back(first, worst);
+            todo.emplace_back(worst, last);
+        }
+    }
+
+    detail::stroke out{s.colour};
+    out.points.reserve(
+        static_cast<std::size_t>(std::count(keep.begin(), keep.end(), true)));
+    for (std::size_t i = 0; i != pts.size(); ++i) {
+        if (keep[i]) {
+            out.points.push_back(pts[i]);
+        }
+    }
+    return out;
+}
+
+} // namespace sketchy
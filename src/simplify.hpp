@@ -0,0 +1,35 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "storage.hpp"
+
+namespace sketchy {
+
+/// Weight is scaled by this when measuring how far a point is from the
+/// simplified line. A change in weight moves each edge of the ink by half
+/// as much
+inline constexpr double simplify_weight_scale = 0.5;
+
+/// Ramer-Douglas-Peucker over (x, y, weight): drops every point which is
+/// within tolerance of the line between the points kept either side of it.
+/// The first and last points are always kept
+auto simplify(const detail::stroke& s, double tolerance,
+              double weight_scale = simplify_weight_scale) -> detail::stroke;
+
+} // namespace sketchy
@@ -23,6 +23,8 @@
 #include <qpainter.h>
 #include <qpainterpath.h>
 
+#include <algorithm>
+
 #include <cronch/json/boost.hpp>
 #include <cronch/meta.hpp>
 
@@ -47,24 +49,111 @@ struct cronch::json::boost::converter<QColor> {
         c = QColor{v.as_string().c_str()};
     }
 };
-CRONCH_META_TYPE(stroke,
-                 (cm::field("s", &stroke::start), cm::field("e", &stroke::end),
-                  cm::field("w", &stroke::weight),
-                  cm::field("c", &stroke::colour)));
+CRONCH_META_TYPE(stroke::line,
+                 (cm::field("s", &stroke::line::start),
+                  cm::field("e", &stroke::line::end),
+                  cm::field("w", &stroke::line::weight),
+                  cm::field("c", &stroke::line::colour)));
+CRONCH_META_TYPE(stroke::point, (cm::field("p", &stroke::point::pos),
+                                 cm::field("w", &stroke::point::weight)));
+CRONCH_META_TYPE(stroke, (cm::field("c", &stroke::colour),
+                          cm::field("p", &stroke::points)));
+
+namespace {
+struct json_document {
+    int version{2};
+    std::vector<stroke> strokes;
+};
+} // namespace
+CRONCH_META_TYPE(json_document,
+                 (cm::field("version", &json_document::version),
+                  cm::field("strokes", &json_document::strokes)));
 
 namespace sketchy {
 namespace detail {
+void stroke::append(const line& l)
+{
+    if (points.empty()) {
+        colour = l.colour;
+    }
+    if (points.empty() || points.back().pos != l.start) {
+        points.push_back({l.start, l.weight});
+    }
+    points.push_back({l.end, l.weight});
+}
+
+auto stroke::bounds() const -> QRectF
+{
+    if (points.empty()) {
+        return {};
+    }
+    auto min_x = points.front().pos.x();
+    auto min_y = points.front().pos.y();
+    auto max_x = min_x;
+    auto max_y = min_y;
+    float max_w = 0;
+    for (const auto& p : points) {
+        min_x = std::min(min_x, p.pos.x());
+        min_y = std::min(min_y, p.pos.y());
+        max_x = std::max(max_x, p.pos.x());
+        max_y = std::max(max_y, p.pos.y());
+        max_w = std::max(max_w, p.weight);
+    }
+    const auto m = max_w / 2.0;
+    return QRectF{QPointF{min_x, min_y}, QPointF{max_x, max_y}}.adjusted(
+        -m, -m, m, m);
+}
 
 } // namespace detail
 
+namespace {
+/// Old documents are a flat array of segments, saved in whatever order the
+/// scene returned them (usually top-most first). Stitch runs of connected
+/// segments back into strokes
+auto from_legacy_lines(std::vector<stroke::line> lines)
+    -> std::vector<detail::stroke>
+{
+    std::size_t forward = 0;
+    std::size_t backward = 0;
+    for (std::size_t i = 1; i < lines.size(); ++i) {
+        forward += lines[i - 1].end == lines[i].start;
+        backward += lines[i - 1].start == lines[i].end;
+    }
+    if (backward > forward) {
+        std::reverse(lines.begin(), lines.end());
+    }
+
+    std::vector<detail::stroke> out;
+    for (const auto& l : lines) {
+        if (out.empty() || out.back().colour != l.colour ||
+            out.back().points.back().pos != l.start) {
+            out.emplace_back(l.colour);
+        }
+        out.back().append(l);
+    }
+    return out;
+}
+
+auto is_legacy_json(const std::string& j) -> bool
+{
+    const auto first = j.find_first_not_of(" \t\r\n");
+    return first != std::string::npos && j[first] == '[';
+}
+} // namespace
+
 auto to_json(const std::vector<detail::stroke>& obj) -> std::string
 {
-    return cronch::serialize<cronch::json::boost>(obj);
+    return cronch::serialize<cronch::json::boost>(
+        json_document{.strokes = obj});
 }
 
 auto from_json(const std::string& j) -> std::vector<detail::stroke>
 {
-    return cronch::deserialize<std::vector<detail::stroke>>(
-        cronch::json::boost{j});
+    if (is_legacy_json(j)) {
+        return from_legacy_lines(
+            cronch::deserialize<std::vector<stroke::line>>(
+                cronch::json::boost{j}));
+    }
+    return cronch::deserialize<json_document>(cronch::json::boost{j}).strokes;
 }
 } // namespace sketchy
@@ -18,7 +18,12 @@
 #pragma once
 
 #include <qgraphicsitem.h>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 #include <qpixmap.h>
 #include <qpoint.h>
@@ -26,31 +31,140 @@
 
 namespace sketchy {
 namespace detail {
+/// A single pen-down to pen-up polyline
 class stroke {
 public:
+    /// Single segment, as stored by the old per-segment format
+    struct line {
+        QPointF start;
+        QPointF end;
+        float weight;
+        QColor colour;
+
+        auto operator==(const line& l) const -> bool
+        {
+            return l.start == start && l.end == end && l.weight == weight &&
+                   l.colour == colour;
+        }
+    };
+    struct point {
+        QPointF pos;
+        float weight;
+
+        auto operator==(const point& p) const -> bool
+        {
+            return p.pos == pos && p.weight == weight;
+        }
+    };
+
     stroke() = default;
-    stroke(QPointF start, QPointF end, float weight, QColor colour)
-        : start{start}, end{end}, weight{weight}, colour{colour}
+    explicit stroke(QColor colour) : colour{colour} {}
+
+    /// Append a segment. The start is only added if it does not continue
+    /// from the last point
+    void append(const line& l);
+    void append(const point& p) { points.emplace_back(p); }
+
+    auto empty() const -> bool { return points.empty(); }
+    auto bounds() const -> QRectF;
+
+    std::vector<point> points;
+    QColor colour{Qt::black};
+
+    auto operator==(const stroke& s) const -> bool
     {
+        return s.colour == colour && s.points == points;
     }
+};
+} // namespace detail
+
+/// Identifies a stroke for the lifetime of a document, never reused
+using stroke_id = std::uint64_t;
 
-    QPointF start;
-    QPointF end;
-    float weight;
-    QColor colour;
+struct stored_stroke {
+    stroke_id id;
+    detail::stroke data;
+    /// Set on pieces left by the eraser to the place in the stacking order
+    /// of the stroke they were cut from, so they stay under anything drawn
+    /// after it
+    std::optional<stroke_id> cut_from{};
 
-    auto operator==(const stroke& l) const -> bool
+    /// Strokes stack by this, then by id
+    auto order() const -> stroke_id { return cut_from.value_or(id); }
+
+    auto operator==(const stored_stroke& s) const -> bool
     {
-        return l.start == start && l.end == end && l.weight == weight &&
-               l.colour == colour;
+        return s.id == id && s.data == data && s.cut_from == cut_from;
     }
+};
 
-private:
+/// Thrown when a document cannot be read
+class bad_document : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+/// Thrown when a document cannot be written
+class io_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
 };
-} // namespace detail
 
 auto to_json(const std::vector<detail::stroke>& obj) -> std::string;
 
+/// Loads both the current format and the old per-segment one
 auto from_json(const std::string& j) -> std::vector<detail::stroke>;
 
+/// Versioned flat binary container, see binary_storage.cpp for the layout.
+/// from_binary only needs a view so it can read straight from a mapped file
+auto to_binary(const std::vector<detail::stroke>& obj) -> std::string;
+auto from_binary(std::string_view data) -> std::vector<detail::stroke>;
+/// Whether data starts with the binary magic bytes
+auto is_binary(std::string_view data) -> bool;
+
+/// Binary document prefixed with the id of each stroke and, if any were cut,
+/// their stacking orders. Used for journal records and notebook tiles
+auto to_binary(const std::vector<stored_stroke>& obj) -> std::string;
+auto from_binary_stored(std::string_view data) -> std::vector<stored_stroke>;
+
+/// Decodes a binary document a stroke at a time straight from the view it
+/// was given, so the first strokes can be used while the rest are still
+/// being read. The header and stroke table are checked up front, throws
+/// bad_document like from_binary
+class binary_reader {
+public:
+    explicit binary_reader(std::string_view data);
+
+    auto size() const -> std::size_t { return table_.size() / 2; }
+    auto done() const -> bool { return next_ == size(); }
+    /// Decode the next stroke, there must be one left
+    auto next() -> detail::stroke;
+
+private:
+    std::vector<std::uint32_t> colours_;
+    /// Colour index then point count for each stroke
+    std::vector<std::uint32_t> table_;
+    std::string_view xs_;
+    std::string_view ys_;
+    std::string_view ws_;
+    std::size_t next_{0};
+    std::size_t offset_{0};
+};
+
+/// binary_reader for strokes written with their ids
+class stored_reader {
+public:
+    explicit stored_reader(std::string_view data);
+
+    auto ids() const -> const std::vector<stroke_id>& { return ids_; }
+    auto done() const -> bool { return strokes_.done(); }
+    auto next() -> stored_stroke;
+
+private:
+    std::vector<stroke_id> ids_;
+    /// Empty if no stroke was cut from another
+    std::vector<stroke_id> orders_;
+    binary_reader strokes_;
+    std::size_t next_{0};
+};
+
 } // namespace sketchy
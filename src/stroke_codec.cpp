@@ -0,0 +1,252 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stroke_codec.hpp"
+#include "binary_io.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+/*
+ * Stream layout:
+ *
+ *   u8 version, f64 resolution (little-endian), u8 weight bits,
+ *   varint stroke count, stroke*
+ *
+ * stroke:
+ *   u32 colour (little-endian 0xAARRGGBB), f32 max weight,
+ *   varint point count,
+ *   { zigzag varint dx, zigzag varint dy, zigzag varint dweight }[count]
+ *
+ * The first point of a stroke is a delta from (0, 0, 0).
+ *
+ * Streams with ids are prefixed with a varint stroke count and the zig-zag
+ * varint delta of each id from the one before. If any stroke was cut from
+ * another, the zig-zag varint of its order less its id follows the stream
+ * for each (see stored_stroke::order()).
+ */
+
+namespace sketchy {
+namespace {
+constexpr std::uint8_t codec_version = 1;
+
+auto weight_levels(const codec_options& opts) -> std::uint32_t
+{
+    const auto bits = std::clamp<int>(opts.weight_bits, 1, 16);
+    return (std::uint32_t{1} << bits) - 1;
+}
+auto quantize(double v, double resolution) -> std::int64_t
+{
+    return std::llround(v / resolution);
+}
+} // namespace
+
+namespace detail {
+void put_varint(std::string& out, std::uint64_t v)
+{
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+auto get_varint(std::string_view& in) -> std::uint64_t
+{
+    std::uint64_t v = 0;
+    for (auto shift = 0; shift < 64; shift += 7) {
+        if (in.empty()) {
+            break;
+        }
+        const auto b = static_cast<std::uint8_t>(in.front());
+        in.remove_prefix(1);
+        v |= std::uint64_t{b & 0x7fu} << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    throw bad_document{"truncated varint in stroke stream"};
+}
+} // namespace detail
+
+void encode_stroke(const detail::stroke& s, const codec_options& opts,
+                   std::string& out)
+{
+    float max_w = 0;
+    for (const auto& p : s.points) {
+        max_w = std::max(max_w, p.weight);
+    }
+    detail::writer w{out};
+    w.write(static_cast<std::uint32_t>(s.colour.rgba()));
+    w.write(max_w);
+    detail::put_varint(out, s.points.size());
+
+    const auto levels = weight_levels(opts);
+    std::int64_t px = 0;
+    std::int64_t py = 0;
+    std::int64_t pw = 0;
+    for (const auto& p : s.points) {
+        const auto x = quantize(p.pos.x(), opts.resolution);
+        const auto y = quantize(p.pos.y(), opts.resolution);
+        const auto wq =
+            max_w > 0 ? std::lround(p.weight / max_w * levels) : 0;
+        detail::put_varint(out, detail::zigzag(x - px));
+        detail::put_varint(out, detail::zigzag(y - py));
+        detail::put_varint(out, detail::zigzag(wq - pw));
+        px = x;
+        py = y;
+        pw = wq;
+    }
+}
+
+auto decode_stroke(std::string_view& in, const codec_options& opts)
+    -> detail::stroke
+{
+    detail::reader r{in};
+    detail::stroke s{QColor::fromRgba(r.read<std::uint32_t>())};
+    const auto max_w = r.read<float>();
+    in.remove_prefix(r.offset());
+    const auto count = detail::get_varint(in);
+    // Every point takes at least three bytes
+    if (count > in.size() / 3) {
+        throw bad_document{"truncated stroke in stroke stream"};
+    }
+
+    const auto levels = static_cast<float>(weight_levels(opts));
+    s.points.reserve(count);
+    std::int64_t x = 0;
+    std::int64_t y = 0;
+    std::int64_t wq = 0;
+    for (std::uint64_t i = 0; i != count; ++i) {
+        x += detail::unzigzag(detail::get_varint(in));
+        y += detail::unzigzag(detail::get_varint(in));
+        wq += detail::unzigzag(detail::get_varint(in));
+        s.points.push_back({{static_cast<double>(x) * opts.resolution,
+                             static_cast<double>(y) * opts.resolution},
+                            static_cast<float>(wq) / levels * max_w});
+    }
+    return s;
+}
+
+auto encode_strokes(const std::vector<detail::stroke>& strokes,
+                    const codec_options& opts) -> std::string
+{
+    std::string out;
+    detail::writer w{out};
+    w.write(codec_version);
+    w.write(opts.resolution);
+    w.write(opts.weight_bits);
+    detail::put_varint(out, strokes.size());
+    for (const auto& s : strokes) {
+        encode_stroke(s, opts, out);
+    }
+    return out;
+}
+
+namespace {
+/// decode_strokes, advancing in past the stream
+auto decode_stream(std::string_view& in) -> std::vector<detail::stroke>
+{
+    detail::reader r{in};
+    if (r.read<std::uint8_t>() > codec_version) {
+        throw bad_document{"stroke stream is from a newer version"};
+    }
+    codec_options opts;
+    opts.resolution = r.read<double>();
+    opts.weight_bits = r.read<std::uint8_t>();
+    if (!(opts.resolution > 0)) {
+        throw bad_document{"stroke stream has an invalid resolution"};
+    }
+    in.remove_prefix(r.offset());
+    const auto count = detail::get_varint(in);
+    if (count > in.size()) {
+        throw bad_document{"truncated stroke stream"};
+    }
+    std::vector<detail::stroke> strokes;
+    strokes.reserve(count);
+    for (std::uint64_t i = 0; i != count; ++i) {
+        strokes.emplace_back(decode_stroke(in, opts));
+    }
+    return strokes;
+}
+} // namespace
+
+auto decode_strokes(std::string_view in) -> std::vector<detail::stroke>
+{
+    return decode_stream(in);
+}
+
+auto encode_strokes(const std::vector<stored_stroke>& strokes,
+                    const codec_options& opts) -> std::string
+{
+    std::string out;
+    detail::put_varint(out, strokes.size());
+    std::int64_t prev = 0;
+    for (const auto& s : strokes) {
+        const auto id = static_cast<std::int64_t>(s.id);
+        detail::put_varint(out, detail::zigzag(id - prev));
+        prev = id;
+    }
+    std::vector<detail::stroke> data;
+    data.reserve(strokes.size());
+    for (const auto& s : strokes) {
+        data.emplace_back(s.data);
+    }
+    out += encode_strokes(data, opts);
+    if (std::any_of(strokes.begin(), strokes.end(),
+                    [](const auto& s) { return s.cut_from; })) {
+        for (const auto& s : strokes) {
+            const auto delta = static_cast<std::int64_t>(s.order() - s.id);
+            detail::put_varint(out, detail::zigzag(delta));
+        }
+    }
+    return out;
+}
+
+auto decode_stored_strokes(std::string_view in) -> std::vector<stored_stroke>
+{
+    const auto count = detail::get_varint(in);
+    if (count > in.size()) {
+        throw bad_document{"truncated stroke stream"};
+    }
+    std::vector<stroke_id> ids(count);
+    std::int64_t prev = 0;
+    for (auto& id : ids) {
+        prev += detail::unzigzag(detail::get_varint(in));
+        id = static_cast<stroke_id>(prev);
+    }
+    auto data = decode_stream(in);
+    if (data.size() != ids.size()) {
+        throw bad_document{"mismatched stroke ids"};
+    }
+    std::vector<stored_stroke> out;
+    out.reserve(ids.size());
+    for (std::size_t i = 0; i != ids.size(); ++i) {
+        out.push_back({ids[i], std::move(data[i])});
+    }
+    // Only there if a stroke was cut
+    if (!in.empty()) {
+        for (auto& s : out) {
+            const auto delta = detail::unzigzag(detail::get_varint(in));
+            if (delta != 0) {
+                s.cut_from = s.id + static_cast<stroke_id>(delta);
+            }
+        }
+    }
+    return out;
+}
+
+} // namespace sketchy
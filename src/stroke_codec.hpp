@@ -0,0 +1,80 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "storage.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sketchy {
+
+/// Lossy compact encoding for strokes.
+///
+/// Positions are quantized to a fixed grid, then each point is stored as
+/// the zig-zag varint delta from the one before it. Weights are quantized
+/// to a number of bits relative to the heaviest point in the stroke and
+/// delta coded the same way. Continuous pen strokes usually come out at two
+/// to four bytes a point
+struct codec_options {
+    /// Size of one quantization step in scene units
+    double resolution{1.0 / 16};
+    /// Bits used for each quantized weight, between 1 and 16
+    std::uint8_t weight_bits{10};
+
+    auto operator==(const codec_options&) const -> bool = default;
+};
+
+namespace detail {
+void put_varint(std::string& out, std::uint64_t v);
+auto get_varint(std::string_view& in) -> std::uint64_t;
+
+constexpr auto zigzag(std::int64_t v) -> std::uint64_t
+{
+    return (static_cast<std::uint64_t>(v) << 1) ^
+           static_cast<std::uint64_t>(v >> 63);
+}
+constexpr auto unzigzag(std::uint64_t v) -> std::int64_t
+{
+    return static_cast<std::int64_t>(v >> 1) ^
+           -static_cast<std::int64_t>(v & 1);
+}
+} // namespace detail
+
+/// Append a single stroke to out, without any header
+void encode_stroke(const detail::stroke& s, const codec_options& opts,
+                   std::string& out);
+/// Decode a stroke written by encode_stroke from the front of in, which is
+/// advanced past it
+auto decode_stroke(std::string_view& in, const codec_options& opts)
+    -> detail::stroke;
+
+/// Self describing stream of strokes, including the options used
+auto encode_strokes(const std::vector<detail::stroke>& strokes,
+                    const codec_options& opts = {}) -> std::string;
+auto decode_strokes(std::string_view in) -> std::vector<detail::stroke>;
+
+/// As encode_strokes, with the ids delta coded in front and the stacking
+/// orders of cut strokes after
+auto encode_strokes(const std::vector<stored_stroke>& strokes,
+                    const codec_options& opts = {}) -> std::string;
+auto decode_stored_strokes(std::string_view in) -> std::vector<stored_stroke>;
+
+} // namespace sketchy
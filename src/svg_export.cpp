@@ -0,0 +1,247 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "svg_export.hpp"
+
+#include <qiodevice.h>
+#include <qthread.h>
+#include <qtconcurrentmap.h>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace sketchy {
+namespace {
+/// Points formatted by one task
+constexpr std::size_t chunk_points = 16 * 1024;
+
+/// Colour and quantized width, paths are merged while this stays the same
+struct path_key {
+    QRgb colour;
+    std::int64_t width;
+
+    auto operator==(const path_key&) const -> bool = default;
+};
+
+/// Polyline data for one run of ink
+struct run_text {
+    path_key key;
+    std::string d;
+};
+
+struct chunk {
+    std::size_t first;
+    std::size_t last;
+    std::vector<run_text> runs;
+};
+
+/// q / 10^precision without trailing zeros
+void put_fixed(std::string& out, std::int64_t q, std::int64_t scale)
+{
+    if (q < 0) {
+        out += '-';
+        q = -q;
+    }
+    fmt::format_to(std::back_inserter(out), "{}", q / scale);
+    auto frac = q % scale;
+    if (frac == 0) {
+        return;
+    }
+    out += '.';
+    for (auto digit = scale / 10; digit > 0 && frac > 0; digit /= 10) {
+        out += static_cast<char>('0' + frac / digit);
+        frac %= digit;
+    }
+}
+
+class formatter {
+public:
+    formatter(const svg_options& opts, QPointF origin)
+        : scale_{static_cast<std::int64_t>(std::pow(10, opts.precision))},
+          width_step_{opts.width_step},
+          origin_{origin}
+    {
+    }
+
+    auto key(const stroke_view& s, float weight) const -> path_key
+    {
+        return {s.colour.rgba(),
+                std::max<std::int64_t>(1, std::llround(weight / width_step_))};
+    }
+
+    void width(std::string& out, std::int64_t w) const
+    {
+        put_fixed(out,
+                  std::llround(static_cast<double>(w) * width_step_ *
+                               static_cast<double>(scale_)),
+                  scale_);
+    }
+
+    /// Absolute moveto then relative lineto in quantized units, so the
+    /// deltas add up exactly
+    void runs(const stroke_view& s, std::vector<run_text>& out) const
+    {
+        if (s.empty()) {
+            return;
+        }
+        auto curr = key(s, s.size() > 1 ? s.ws[1] : s.ws[0]);
+        auto* run = &out.emplace_back(run_text{curr, {}});
+        auto last = quantize(s.point(0).pos);
+        move_to(run->d, last);
+        if (s.size() == 1) {
+            // Zero length, drawn as a dot by the round cap
+            run->d += "l0 0";
+            return;
+        }
+        run->d += 'l';
+        for (std::size_t i = 1; i != s.size(); ++i) {
+            if (const auto k = key(s, s.ws[i]); k != curr) {
+                curr = k;
+                run = &out.emplace_back(run_text{curr, {}});
+                move_to(run->d, last);
+                run->d += 'l';
+            }
+            else if (run->d.back() != 'l') {
+                run->d += ' ';
+            }
+            const auto q = quantize(s.point(i).pos);
+            put_fixed(run->d, q.first - last.first, scale_);
+            run->d += ' ';
+            put_fixed(run->d, q.second - last.second, scale_);
+            last = q;
+        }
+    }
+
+private:
+    using qpoint = std::pair<std::int64_t, std::int64_t>;
+
+    auto quantize(const QPointF& p) const -> qpoint
+    {
+        const auto s = static_cast<double>(scale_);
+        return {std::llround((p.x() - origin_.x()) * s),
+                std::llround((p.y() - origin_.y()) * s)};
+    }
+    void move_to(std::string& d, const qpoint& p) const
+    {
+        d += 'M';
+        put_fixed(d, p.first, scale_);
+        d += ' ';
+        put_fixed(d, p.second, scale_);
+    }
+
+    std::int64_t scale_;
+    double width_step_;
+    QPointF origin_;
+};
+
+void write(QIODevice& out, const std::string& s)
+{
+    if (out.write(s.data(), static_cast<qint64>(s.size())) !=
+        static_cast<qint64>(s.size())) {
+        throw io_error{"failed to write svg"};
+    }
+}
+} // namespace
+
+void write_svg(QIODevice& out, const document& doc,
+               const svg_options& opts)
+{
+    const auto ink = doc.bounds().adjusted(-opts.margin, -opts.margin,
+                                           opts.margin, opts.margin);
+    const auto w = std::ceil(ink.width());
+    const auto h = std::ceil(ink.height());
+    const formatter style{opts, ink.topLeft()};
+
+    std::string text = fmt::format(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"{0}\" "
+        "height=\"{1}\" viewBox=\"0 0 {0} {1}\">\n"
+        "<g fill=\"none\" stroke-linecap=\"round\" "
+        "stroke-linejoin=\"round\">",
+        w, h);
+
+    std::vector<chunk> chunks;
+    for (std::size_t i = 0; i != doc.size();) {
+        chunk c{i, i, {}};
+        for (std::size_t pts = 0; c.last != doc.size() && pts < chunk_points;
+             ++c.last) {
+            pts += doc.view(c.last).size();
+        }
+        i = c.last;
+        chunks.push_back(std::move(c));
+    }
+
+    // A few rounds of chunks per thread at a time, written out in order
+    // before the next round is formatted
+    const auto window =
+        static_cast<std::size_t>(std::max(1, QThread::idealThreadCount())) * 2;
+    std::optional<path_key> open;
+    for (auto first = chunks.begin(); first != chunks.end();) {
+        const auto last =
+            first + std::min(static_cast<std::ptrdiff_t>(window),
+                             std::distance(first, chunks.end()));
+        QtConcurrent::blockingMap(first, last, [&doc, &style](chunk& c) {
+            for (auto i = c.first; i != c.last; ++i) {
+                style.runs(doc.view(i), c.runs);
+            }
+        });
+        for (auto it = first; it != last; ++it) {
+            for (const auto& run : it->runs) {
+                if (open == run.key) {
+                    text += ' ';
+                }
+                else {
+                    if (open) {
+                        text += "\"/>";
+                    }
+                    const QColor c = QColor::fromRgba(run.key.colour);
+                    text += fmt::format("\n<path stroke=\"{}\" ",
+                                        c.name().toStdString());
+                    if (c.alpha() != 255) {
+                        text +=
+                            fmt::format("stroke-opacity=\"{:.3f}\" ",
+                                        c.alphaF());
+                    }
+                    text += "stroke-width=\"";
+                    style.width(text, run.key.width);
+                    text += "\" d=\"";
+                    open = run.key;
+                }
+                text += run.d;
+            }
+            it->runs = {};
+            write(out, text);
+            text.clear();
+        }
+        first = last;
+    }
+    if (open) {
+        text += "\"/>";
+    }
+    text += "\n</g>\n</svg>\n";
+    write(out, text);
+}
+
+} // namespace sketchy
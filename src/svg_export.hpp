@@ -0,0 +1,44 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "document.hpp"
+
+class QIODevice;
+
+namespace sketchy {
+
+struct svg_options {
+    /// Decimal places kept for coordinates and widths
+    int precision{2};
+    /// Widths are rounded to multiples of this, so that neighbouring runs
+    /// of ink can share a path
+    double width_step{0.25};
+    /// Space left around the ink
+    double margin{0};
+};
+
+/// Write doc as SVG, cropped to the ink. Consecutive runs of ink with the
+/// same colour and width, in stacking order, are merged into one path of
+/// polylines. Coordinates are formatted in parallel a chunk at a time and
+/// written out as each chunk is done, so the whole file is never held in
+/// memory
+void write_svg(QIODevice& out, const document& doc,
+               const svg_options& opts = {});
+
+} // namespace sketchy
@@ -0,0 +1,349 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "tile_store.hpp"
+#include "binary_io.hpp"
+#include "stroke_codec.hpp"
+
+#include <qsavefile.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * Layout, all little-endian:
+ *
+ *   header:
+ *     "SKTILES\0" u32 version u32 reserved f64 tile size u64 index offset
+ *   tile blobs, each a stroke codec stream with ids (see stroke_codec.hpp).
+ *   Version 1 notebooks use binary documents with ids instead
+ *   index:
+ *     u64 next stroke id, u64 tile count
+ *     { i32 x, i32 y, u64 offset, u64 length, u64 strokes,
+ *       f64 left, f64 top, f64 right, f64 bottom }[tile count]
+ */
+
+namespace sketchy {
+namespace {
+constexpr std::string_view tiles_magic{"SKTILES\0", 8};
+constexpr std::uint32_t tiles_version = 2;
+constexpr std::size_t header_size = 32;
+constexpr std::size_t index_offset_at = 24;
+/// Superseded blobs and indexes are left in place until there is more of
+/// them than of live data, and at least this much
+constexpr std::uint64_t min_compact_size = 4 * 1024 * 1024;
+
+auto encode_header(double tile_size, std::uint64_t index_offset,
+                   std::uint32_t version = tiles_version) -> std::string
+{
+    std::string out{tiles_magic};
+    detail::writer w{out};
+    w.write(version);
+    w.write(std::uint32_t{0});
+    w.write(tile_size);
+    w.write(index_offset);
+    return out;
+}
+
+auto encode_index(const tile_store::index_t& index, stroke_id next_id)
+    -> std::string
+{
+    std::string out;
+    detail::writer w{out};
+    w.write(static_cast<std::uint64_t>(next_id));
+    w.write(static_cast<std::uint64_t>(index.size()));
+    for (const auto& [t, info] : index) {
+        w.write(t.x);
+        w.write(t.y);
+        w.write(info.offset);
+        w.write(info.length);
+        w.write(info.strokes);
+        w.write(info.bounds.left());
+        w.write(info.bounds.top());
+        w.write(info.bounds.right());
+        w.write(info.bounds.bottom());
+    }
+    return out;
+}
+
+auto stroke_bounds(const std::vector<stored_stroke>& strokes) -> QRectF
+{
+    QRectF out;
+    for (const auto& s : strokes) {
+        out = out.isNull() ? s.data.bounds() : out.united(s.data.bounds());
+    }
+    return out;
+}
+
+auto encode_tile(const std::vector<stored_stroke>& strokes,
+                 std::uint32_t version) -> std::string
+{
+    return version < 2 ? to_binary(strokes) : encode_strokes(strokes);
+}
+auto decode_tile(std::string_view blob, std::uint32_t version)
+    -> std::vector<stored_stroke>
+{
+    return version < 2 ? from_binary_stored(blob)
+                       : decode_stored_strokes(blob);
+}
+
+void write_all(QFileDevice& f, const std::string& data)
+{
+    if (f.write(data.data(), data.size()) !=
+        static_cast<qint64>(data.size())) {
+        throw io_error{"failed to write notebook"};
+    }
+}
+
+void sync(QFile& f)
+{
+    f.flush();
+#ifdef _WIN32
+    _commit(f.handle());
+#else
+    ::fsync(f.handle());
+#endif
+}
+} // namespace
+
+void tile_store::create(const QString& path,
+                        const std::vector<stored_stroke>& doc,
+                        double tile_size)
+{
+    std::unordered_map<tile_coord, std::vector<stored_stroke>> tiles;
+    stroke_id next_id = 0;
+    for (const auto& s : doc) {
+        tiles[tile_of(s.data, tile_size)].emplace_back(s);
+        next_id = std::max(next_id, s.id + 1);
+    }
+
+    QSaveFile f{path};
+    if (!f.open(QFile::WriteOnly)) {
+        throw io_error{"failed to create notebook"};
+    }
+    index_t index;
+    std::uint64_t at = header_size;
+    write_all(f, encode_header(tile_size, 0));
+    for (const auto& [t, strokes] : tiles) {
+        const auto blob = encode_tile(strokes, tiles_version);
+        write_all(f, blob);
+        index.emplace(t, tile_info{at, blob.size(), strokes.size(),
+                                   stroke_bounds(strokes)});
+        at += blob.size();
+    }
+    write_all(f, encode_index(index, next_id));
+    f.seek(0);
+    write_all(f, encode_header(tile_size, at));
+    if (!f.commit()) {
+        throw io_error{"failed to create notebook"};
+    }
+}
+
+auto tile_store::is_tile_store(std::string_view data) -> bool
+{
+    return data.substr(0, tiles_magic.size()) == tiles_magic;
+}
+
+tile_store::tile_store(const QString& path) : file_{path}
+{
+    if (!file_.open(QFile::ReadWrite)) {
+        throw bad_document{"failed to open notebook"};
+    }
+    const auto header = file_.read(header_size);
+    const std::string_view hv{header.constData(),
+                              static_cast<std::size_t>(header.size())};
+    if (!is_tile_store(hv)) {
+        throw bad_document{"not a sketchy notebook"};
+    }
+    detail::reader hr{hv.substr(tiles_magic.size())};
+    version_ = hr.read<std::uint32_t>();
+    if (version_ > tiles_version) {
+        throw bad_document{"notebook is from a newer version"};
+    }
+    hr.read<std::uint32_t>();
+    tile_size_ = hr.read<double>();
+    const auto index_offset = hr.read<std::uint64_t>();
+
+    file_.seek(index_offset);
+    const auto raw = file_.readAll();
+    detail::reader r{{raw.constData(), static_cast<std::size_t>(raw.size())}};
+    next_id_ = r.read<std::uint64_t>();
+    const auto count = r.read<std::uint64_t>();
+    for (std::uint64_t i = 0; i != count; ++i) {
+        tile_coord t{};
+        tile_info info{};
+        t.x = r.read<std::int32_t>();
+        t.y = r.read<std::int32_t>();
+        info.offset = r.read<std::uint64_t>();
+        info.length = r.read<std::uint64_t>();
+        info.strokes = r.read<std::uint64_t>();
+        const auto left = r.read<double>();
+        const auto top = r.read<double>();
+        const auto right = r.read<double>();
+        const auto bottom = r.read<double>();
+        info.bounds = QRectF{QPointF{left, top}, QPointF{right, bottom}};
+        index_.emplace(t, info);
+    }
+    // Anything after the index was written by a store() that was never
+    // flushed, so it is safe to write over
+    end_ = index_offset + r.offset();
+}
+
+auto tile_store::index() const -> index_t
+{
+    const std::lock_guard lock{mutex_};
+    return index_;
+}
+
+auto tile_store::contains(tile_coord t) const -> bool
+{
+    const std::lock_guard lock{mutex_};
+    return index_.contains(t);
+}
+
+auto tile_store::next_id() const -> stroke_id
+{
+    const std::lock_guard lock{mutex_};
+    return next_id_;
+}
+
+auto tile_store::bounds() const -> QRectF
+{
+    const std::lock_guard lock{mutex_};
+    QRectF out;
+    for (const auto& [t, info] : index_) {
+        out = out.isNull() ? info.bounds : out.united(info.bounds);
+    }
+    return out;
+}
+
+auto tile_store::load(tile_coord t) -> std::vector<stored_stroke>
+{
+    QByteArray blob;
+    {
+        const std::lock_guard lock{mutex_};
+        const auto it = index_.find(t);
+        if (it == index_.end()) {
+            return {};
+        }
+        file_.seek(it->second.offset);
+        blob = file_.read(it->second.length);
+        if (static_cast<std::uint64_t>(blob.size()) != it->second.length) {
+            throw bad_document{"notebook tile is truncated"};
+        }
+    }
+    // Decoded without the lock, that is the slow part
+    return decode_tile(
+        {blob.constData(), static_cast<std::size_t>(blob.size())}, version_);
+}
+
+void tile_store::store(tile_coord t, const std::vector<stored_stroke>& strokes,
+                       std::uint64_t when)
+{
+    const auto blob =
+        strokes.empty() ? std::string{} : encode_tile(strokes, version_);
+    const std::lock_guard lock{mutex_};
+    auto& last = stored_at_[t];
+    if (when < last) {
+        return;
+    }
+    last = when;
+    for (const auto& s : strokes) {
+        next_id_ = std::max(next_id_, s.id + 1);
+    }
+    if (strokes.empty()) {
+        index_.erase(t);
+        return;
+    }
+    file_.seek(end_);
+    write_all(file_, blob);
+    index_[t] = {end_, blob.size(), strokes.size(), stroke_bounds(strokes)};
+    end_ += blob.size();
+}
+
+void tile_store::flush()
+{
+    const std::lock_guard lock{mutex_};
+    const auto index_offset = end_;
+    const auto index = encode_index(index_, next_id_);
+    file_.seek(index_offset);
+    write_all(file_, index);
+    // The header is only pointed at the new index once it is on disk, and
+    // the change is on disk before anything is written after it
+    sync(file_);
+    file_.seek(index_offset_at);
+    std::string offset;
+    detail::writer{offset}.write(index_offset);
+    write_all(file_, offset);
+    sync(file_);
+    end_ = index_offset + index.size();
+
+    std::uint64_t live = header_size + index.size();
+    for (const auto& [t, info] : index_) {
+        live += info.length;
+    }
+    const auto garbage = end_ - live;
+    if (garbage > min_compact_size && garbage > live) {
+        compact();
+    }
+}
+
+void tile_store::compact()
+{
+    // Called from flush(), which holds the lock
+    // Written to a temporary next to the file and renamed over it on commit
+    QSaveFile out{file_.fileName()};
+    if (!out.open(QFile::WriteOnly)) {
+        throw io_error{"failed to compact notebook"};
+    }
+    write_all(out, encode_header(tile_size_, 0, version_));
+    index_t moved;
+    std::uint64_t at = header_size;
+    for (const auto& [t, info] : index_) {
+        // Copied as they are, nothing is decoded
+        file_.seek(info.offset);
+        const auto blob = file_.read(info.length);
+        if (static_cast<std::uint64_t>(blob.size()) != info.length) {
+            throw bad_document{"notebook tile is truncated"};
+        }
+        if (out.write(blob.constData(), blob.size()) != blob.size()) {
+            throw io_error{"failed to compact notebook"};
+        }
+        moved.emplace(t, tile_info{at, info.length, info.strokes,
+                                   info.bounds});
+        at += info.length;
+    }
+    const auto index = encode_index(moved, next_id_);
+    write_all(out, index);
+    out.seek(0);
+    write_all(out, encode_header(tile_size_, at, version_));
+    if (!out.commit()) {
+        throw io_error{"failed to compact notebook"};
+    }
+    // The handle still points at the file which was replaced
+    file_.close();
+    if (!file_.open(QFile::ReadWrite)) {
+        throw io_error{"failed to reopen notebook after compaction"};
+    }
+    index_ = std::move(moved);
+    end_ = at + index.size();
+}
+
+} // namespace sketchy
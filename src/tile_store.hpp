@@ -0,0 +1,144 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "storage.hpp"
+
+#include <qfile.h>
+#include <qrect.h>
+#include <qstring.h>
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sketchy {
+
+struct tile_coord {
+    std::int32_t x;
+    std::int32_t y;
+
+    auto operator==(const tile_coord& t) const -> bool
+    {
+        return t.x == x && t.y == y;
+    }
+};
+
+/// Tile which owns a stroke, decided by the centre of its bounds so that
+/// every stroke lives in exactly one tile
+inline auto tile_of(const QPointF& p, double tile_size) -> tile_coord
+{
+    return {static_cast<std::int32_t>(std::floor(p.x() / tile_size)),
+            static_cast<std::int32_t>(std::floor(p.y() / tile_size))};
+}
+inline auto tile_of(const detail::stroke& s, double tile_size) -> tile_coord
+{
+    return tile_of(s.bounds().center(), tile_size);
+}
+inline auto tile_bounds(tile_coord t, double tile_size) -> QRectF
+{
+    return QRectF{t.x * tile_size, t.y * tile_size, tile_size, tile_size};
+}
+} // namespace sketchy
+
+template<>
+struct std::hash<sketchy::tile_coord> {
+    auto operator()(const sketchy::tile_coord& t) const noexcept
+        -> std::size_t
+    {
+        return std::hash<std::uint64_t>{}(
+            (std::uint64_t{static_cast<std::uint32_t>(t.x)} << 32) |
+            static_cast<std::uint32_t>(t.y));
+    }
+};
+
+namespace sketchy {
+
+/// Notebook file split into fixed size world tiles which can be read and
+/// written independently.
+///
+/// Tiles are appended as blobs and located through an index at the end of
+/// the file. Writing a tile back appends a new blob, flush() then appends a
+/// new index and points the header at it, so the file on disk always has a
+/// complete index. Once superseded blobs and indexes outweigh the live
+/// ones, flush() reclaims the space by rewriting the file.
+///
+/// Tiles go through the stroke codec, so positions are kept to the default
+/// codec_options resolution. Safe to share between threads, so tiles can be
+/// written back on a worker while others are paged in
+class tile_store {
+public:
+    struct tile_info {
+        std::uint64_t offset;
+        std::uint64_t length;
+        std::uint64_t strokes;
+        /// Union of the bounds of every stroke in the tile, which may spill
+        /// over the tile itself
+        QRectF bounds;
+    };
+    using index_t = std::unordered_map<tile_coord, tile_info>;
+
+    static constexpr double default_tile_size = 2048;
+
+    /// Write doc out as a new notebook at path, replacing any existing file
+    static void create(const QString& path,
+                       const std::vector<stored_stroke>& doc,
+                       double tile_size = default_tile_size);
+    static auto is_tile_store(std::string_view data) -> bool;
+
+    /// Open an existing notebook, only the header and index are read
+    explicit tile_store(const QString& path);
+
+    auto tile_size() const -> double { return tile_size_; }
+    /// Copy of the index, which another thread may be changing
+    auto index() const -> index_t;
+    auto contains(tile_coord t) const -> bool;
+    /// One past the largest id in the notebook
+    auto next_id() const -> stroke_id;
+    /// Union of the bounds of every tile
+    auto bounds() const -> QRectF;
+
+    auto load(tile_coord t) -> std::vector<stored_stroke>;
+    /// Replace the contents of a tile. Not visible to other readers of the
+    /// file until flush(). when orders stores of the same tile, one older
+    /// than the last is dropped so a slow writer cannot put back a stale
+    /// copy
+    void store(tile_coord t, const std::vector<stored_stroke>& strokes,
+               std::uint64_t when = 0);
+    void flush();
+
+private:
+    /// Atomically replace the file with just the live tiles and an index
+    void compact();
+
+    mutable std::mutex mutex_;
+    QFile file_;
+    index_t index_;
+    double tile_size_{default_tile_size};
+    stroke_id next_id_{0};
+    std::uint64_t end_{0};
+    std::uint32_t version_{0};
+    /// when of the last store of each tile
+    std::unordered_map<tile_coord, std::uint64_t> stored_at_;
+};
+
+} // namespace sketchy
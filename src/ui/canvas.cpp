@@ -16,24 +16,55 @@
 // along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "canvas.hpp"
+#include "metrics.hpp"
 #include "qt_fmt.hpp"
+#include "simplify.hpp"
+#include "ui/paint.hpp"
 
 #include <QMouseEvent>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <fmt/core.h>
 #include <iterator>
 #include <qapplication.h>
 #include <qboxlayout.h>
 #include <qevent.h>
+#include <qfontdatabase.h>
 #include <qgraphicsscene.h>
 #include <qgraphicsview.h>
 #include <qnamespace.h>
-#include <qscrollbar.h>
+#include <qpainterpath.h>
 
 #include <qpixmap.h>
+#include <qscreen.h>
 #include <spdlog/spdlog.h>
+#include <utility>
 
 namespace {
+/// Pen moves closer than this to the last one kept are dropped, in device
+/// pixels, unless they come after sample_hold_ms
+constexpr double min_sample_px = 0.5;
+constexpr double sample_hold_ms = 8;
+
+constexpr double min_zoom = 1.0 / 64;
+constexpr double max_zoom = 32;
+/// Zoom for one notch of a mouse wheel
+constexpr double wheel_zoom_step = 1.25;
+
+auto steady_ms() -> double
+{
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+auto to_us(double ms) -> std::uint64_t
+{
+    return ms > 0 ? static_cast<std::uint64_t>(ms * 1000) : 0;
+}
+
 void fill_with_transparent(QPixmap& m)
 {
     QColor c{Qt::white};
@@ -47,9 +78,10 @@ namespace sketchy::ui {
 canvas::canvas(logger_t logger)
     : logger_{std::move(logger)},
       curr_pen_{Qt::black},
-      viewport_{new canvas_view{&scene_}}
+      viewport_{new canvas_view{&scene_}},
+      ink_{[this](QPainter& p, const QRectF& area) { render_ink(p, area); }}
 {
-    logger_->trace("canvas::canvas()");
+    SKETCHY_TRACE(logger_, "canvas::canvas()");
     scene_.setBackgroundBrush(QBrush{Qt::white});
     (new QVBoxLayout{this})->addWidget(viewport_);
     connect(&scene_, &canvas_scene::on_pointer_event, this,
@@ -58,27 +90,449 @@ canvas::canvas(logger_t logger)
             &canvas::on_mouse_enter);
     connect(&scene_, &canvas_scene::on_mouse_leave, this,
             &canvas::on_mouse_leave);
+    connect(viewport_, &canvas_view::visible_area_changed, this,
+            &canvas::update_resident_tiles);
+    viewport_->set_ink_cache(&ink_);
+    viewport_->setRenderHint(QPainter::Antialiasing);
     viewport_->setMouseTracking(true);
     viewport_->setTabletTracking(true);
+    frame_timer_.setSingleShot(true);
+    frame_timer_.setTimerType(Qt::PreciseTimer);
+    connect(&frame_timer_, &QTimer::timeout, this, &canvas::flush_samples);
+}
+
+canvas::~canvas()
+{
+    if (const auto& p = predictor_.stats(); p.checked != 0) {
+        logger_->info("ink prediction hid {:.1f}ms of latency on average, "
+                      "{} of {} within {} units, mean error {:.2f}",
+                      p.hidden_latency_ms(), p.hits, p.checked,
+                      predict_tolerance, p.mean_error());
+    }
+    scene_.setItemIndexMethod(QGraphicsScene::NoIndex);
+    destroy_items();
 }
 
 void canvas::print_area(QPainter& to, const QRectF& area) const
 {
-    viewport_->render(&to, area);
+    viewport_->render_vector(&to, area);
 }
 auto canvas::scene_size() const -> QSizeF { return scene_.sceneRect().size(); }
+void canvas::zoom_by(double factor)
+{
+    viewport_->zoom_by(factor, QRectF{viewport_->viewport()->rect()}.center());
+}
+auto canvas::memory() const -> memory_stats
+{
+    memory_stats m;
+    const auto d = doc_.memory_parts();
+    m.strokes = doc_.size();
+    m.points = doc_.points();
+    m.point_bytes = d.points;
+    m.stroke_bytes = d.strokes;
+    m.palette_bytes = d.palette;
+    m.removed_point_bytes = d.removed_points;
+    m.point_blocks = d.blocks;
+    m.items = items_.size();
+    m.item_slots = items_.capacity();
+    m.item_bytes = items_.capacity() * sizeof(stroke);
+    for (const auto& [id, s] : by_id_) {
+        if (const auto b = s->outline_bytes(); b != 0) {
+            ++m.outlines;
+            m.outline_bytes += b;
+        }
+        m.lod_levels += s->lod().levels();
+        m.lod_bytes += s->lod().memory_usage();
+    }
+    // A node per entry holding the pair and the next node, and the buckets
+    m.id_map_bytes =
+        by_id_.size() * (sizeof(decltype(by_id_)::value_type) +
+                         sizeof(void*)) +
+        by_id_.bucket_count() * sizeof(void*);
+    m.scene_items = static_cast<std::size_t>(scene_.items().size());
+    m.scene_indexed =
+        scene_.itemIndexMethod() == QGraphicsScene::BspTreeIndex;
+    m.scene_index_depth = scene_.bspTreeDepth();
+    m.ink_tiles = ink_.size();
+    m.ink_tile_bytes = ink_.bytes();
+    m.resident_tiles = resident_.size();
+    m.resident_bytes = resident_bytes_;
+    m.heap = read_heap_stats();
+    return m;
+}
+void canvas::debug_overlay(const QString& text)
+{
+    viewport_->set_overlay(text);
+}
+void canvas::reset_zoom() { zoom_by(1 / viewport_->zoom()); }
+auto canvas::visible_area() const -> QRectF
+{
+    return viewport_->mapToScene(viewport_->viewport()->rect())
+        .boundingRect();
+}
 
 void canvas::set_strokes(const std::vector<detail::stroke>& s)
 {
+    std::vector<stored_stroke> stored;
+    stored.reserve(s.size());
+    for (const auto& ds : s) {
+        stored.push_back({stored.size(), ds});
+    }
+    set_strokes(stored);
+}
+void canvas::set_strokes(const std::vector<stored_stroke>& s)
+{
+    ids_pending_ = false;
+    drop_live_stroke();
+    // Indexing each item as it comes and goes costs far more than building
+    // the index once at the end
+    scene_.setItemIndexMethod(QGraphicsScene::NoIndex);
+    destroy_items();
     scene_.clear();
-    std::for_each(s.begin(), s.end(),
-                  [this](const auto& ds) { scene_.addItem(new stroke{ds}); });
+    doc_.clear();
+    store_.reset();
+    ink_.clear();
+    grid_.clear();
+    resident_.clear();
+    resident_bytes_ = 0;
+    doc_.add(s);
+    add_items(s);
+    // Not the top stroke's id, pieces cut from a stroke keep its place
+    next_id_ = 0;
+    for (const auto& stored : s) {
+        next_id_ = std::max(next_id_, stored.id + 1);
+    }
+    scene_.setItemIndexMethod(QGraphicsScene::BspTreeIndex);
+    mark_saved();
     scene_.update();
 }
-void canvas::curr_mode(mode m) { curr_mode_ = m; }
+void canvas::begin_load()
+{
+    set_strokes(std::vector<stored_stroke>{});
+    scene_.setItemIndexMethod(QGraphicsScene::NoIndex);
+    ids_pending_ = true;
+}
+void canvas::end_load()
+{
+    scene_.setItemIndexMethod(QGraphicsScene::BspTreeIndex);
+}
+void canvas::add_loaded(const std::vector<stored_stroke>& batch,
+                        stroke_id next_id)
+{
+    ids_pending_ = false;
+    next_id_ = std::max(next_id_, next_id);
+    doc_.add(batch);
+    scene_.update(add_items(batch));
+}
+auto canvas::add_item(stroke_id id) -> stroke*
+{
+    const auto s = doc_.get(id);
+    auto* item = items_.make(doc_, s);
+    place_item(item, s.order);
+    settle_item(item);
+    return item;
+}
+auto canvas::add_items(const std::vector<stored_stroke>& strokes) -> QRectF
+{
+    items_.reserve(strokes.size());
+    by_id_.reserve(by_id_.size() + strokes.size());
+    QRectF dirty;
+    for (const auto& ss : strokes) {
+        const auto s = doc_.get(ss.id);
+        auto* item = items_.make(doc_, s);
+        place_item(item, s.order);
+        grid_.insert(s);
+        dirty = dirty.united(item->boundingRect());
+    }
+    ink_.invalidate(dirty);
+    return dirty;
+}
+void canvas::drop_live_stroke()
+{
+    curr_stroke_ = nullptr;
+    frame_timer_.stop();
+    pending_.clear();
+    pending_times_.clear();
+    predictor_.reset();
+}
+void canvas::destroy_items()
+{
+    for (auto& [id, s] : by_id_) {
+        items_.destroy(s);
+    }
+    by_id_.clear();
+    items_.reset();
+}
+void canvas::place_item(stroke* s, stroke_id order)
+{
+    // The same as the document, so the stacking order stays stable when
+    // tiles are paged back in out of order
+    s->setZValue(static_cast<qreal>(order));
+    by_id_.emplace(s->id(), s);
+    scene_.addItem(s);
+}
+void canvas::settle_item(stroke* s)
+{
+    // Painted through the ink cache rather than by the scene
+    s->setFlag(QGraphicsItem::ItemHasNoContents);
+    ink_.invalidate(s->boundingRect());
+    grid_.insert(s->view());
+}
+void canvas::commit_item(stroke* s)
+{
+    unsaved_added_.emplace(s->id());
+    if (store_) {
+        const auto t = tile_of(s->view().bounds.center(), store_->tile_size());
+        if (!resident_.contains(t) && store_->contains(t)) {
+            load_tile(t);
+        }
+        track_item(s, true);
+    }
+}
+void canvas::remove_items(const std::vector<stroke*>& items)
+{
+    for (auto* s : items) {
+        if (unsaved_added_.erase(s->id()) == 0) {
+            unsaved_erased_.emplace_back(s->id());
+        }
+        if (store_) {
+            untrack_item(s);
+        }
+        ink_.invalidate(s->boundingRect());
+    }
+    drop_items(items);
+}
+void canvas::drop_items(const std::vector<stroke*>& items)
+{
+    std::vector<stroke_id> ids;
+    ids.reserve(items.size());
+    for (auto* s : items) {
+        grid_.remove(s->view());
+        ids.push_back(s->id());
+        by_id_.erase(s->id());
+        scene_.removeItem(s);
+        items_.destroy(s);
+    }
+    // Once for the lot, views into the document are invalid after this
+    doc_.remove(ids);
+}
+
+void canvas::render_ink(QPainter& p, const QRectF& area)
+{
+    // Straight from the document, the live stroke is not in it yet
+    doc_.query(area, query_);
+    // Device pixels per scene unit, ink tiles are drawn scaled
+    const auto scale =
+        p.worldTransform().m11() * p.device()->devicePixelRatioF();
+    outline_painter ink{p};
+    for (const auto i : query_) {
+        const auto s = doc_.view(i);
+        const auto across = std::max(s.bounds.width(), s.bounds.height());
+        if (across * scale < lod_dot_px) {
+            ink.paint_dot(s.bounds, s.colour);
+        }
+        else {
+            ink.paint(by_id_.at(s.id)->outline(scale), s.colour);
+        }
+    }
+}
+
+void canvas::open_store(std::shared_ptr<tile_store> store)
+{
+    set_strokes(std::vector<stored_stroke>{});
+    store_ = std::move(store);
+    next_id_ = store_->next_id();
+    update_resident_tiles();
+}
+void canvas::memory_budget(std::size_t bytes)
+{
+    memory_budget_ = bytes;
+    evict_over_budget();
+}
+auto canvas::begin_tile_writes() -> tile_writes
+{
+    tile_writes w;
+    if (!store_) {
+        return w;
+    }
+    w.store = store_;
+    w.when = ++tile_writes_;
+    for (auto& [t, tile] : resident_) {
+        if (tile.dirty) {
+            w.tiles.emplace_back(t, tile_strokes(tile));
+            tile.dirty = false;
+            tile.writing = true;
+        }
+    }
+    return w;
+}
+void tile_writes::write() const
+{
+    if (!store) {
+        return;
+    }
+    for (const auto& [t, strokes] : tiles) {
+        store->store(t, strokes, when);
+    }
+    store->flush();
+}
+void canvas::end_tile_writes(const tile_writes& w, bool written)
+{
+    // Another notebook could have been opened since
+    if (w.store != store_) {
+        return;
+    }
+    for (const auto& [t, strokes] : w.tiles) {
+        if (auto it = resident_.find(t); it != resident_.end()) {
+            it->second.writing = false;
+            it->second.dirty |= !written;
+        }
+    }
+}
+
+auto canvas::tile_strokes(const resident_tile& t) const
+    -> std::vector<stored_stroke>
+{
+    std::vector<stored_stroke> out;
+    out.reserve(t.items.size());
+    for (const auto* s : t.items) {
+        out.push_back(s->view().to_stored());
+    }
+    std::sort(out.begin(), out.end(),
+              [](const auto& l, const auto& r) { return l.id < r.id; });
+    return out;
+}
+
+namespace {
+template<typename Item>
+auto item_cost(const Item& s) -> std::size_t
+{
+    // Counts the outline as if it had been worked out, so the cost does not
+    // change when it is. The levels of detail count as one more outline,
+    // which together they are seldom more than
+    const auto points = s.view().size();
+    return sizeof(Item) + points * document::point_bytes +
+           2 * (2 * points + 2 * outline_cap_segments) * sizeof(QPointF);
+}
+} // namespace
+
+void canvas::track_item(stroke* s, bool dirty)
+{
+    const auto coord = tile_of(s->view().bounds.center(), store_->tile_size());
+    auto& tile = resident_[coord];
+    const auto cost = item_cost(*s);
+    tile.items.emplace(s);
+    tile.bytes += cost;
+    tile.last_near = near_tick_;
+    tile.dirty |= dirty;
+    resident_bytes_ += cost;
+}
+void canvas::untrack_item(stroke* s)
+{
+    const auto coord = tile_of(s->view().bounds.center(), store_->tile_size());
+    if (auto it = resident_.find(coord); it != resident_.end()) {
+        const auto cost = item_cost(*s);
+        it->second.items.erase(s);
+        it->second.bytes -= cost;
+        it->second.dirty = true;
+        resident_bytes_ -= cost;
+    }
+}
+
+void canvas::load_tile(tile_coord t)
+{
+    auto strokes = store_->load(t);
+    auto& tile = resident_[t];
+    tile.last_near = near_tick_;
+    doc_.add(strokes);
+    add_items(strokes);
+    for (const auto& s : strokes) {
+        track_item(by_id_.at(s.id), false);
+    }
+    SKETCHY_DEBUG(logger_, "paged in tile {}, {} ({} strokes)", t.x, t.y,
+                  strokes.size());
+}
+
+void canvas::evict_tile(tile_coord t)
+{
+    auto it = resident_.find(t);
+    // A copy being written may yet fail, so this one is written regardless
+    if (it->second.dirty || it->second.writing) {
+        store_->store(t, tile_strokes(it->second), ++tile_writes_);
+    }
+    const std::vector<stroke*> items{it->second.items.begin(),
+                                     it->second.items.end()};
+    for (auto* s : items) {
+        // Already written to the store, so not unsaved any more
+        unsaved_added_.erase(s->id());
+    }
+    drop_items(items);
+    resident_bytes_ -= it->second.bytes;
+    resident_.erase(it);
+    SKETCHY_DEBUG(logger_, "evicted tile {}, {}", t.x, t.y);
+}
+
+void canvas::evict_over_budget()
+{
+    if (!store_) {
+        return;
+    }
+    while (resident_bytes_ > memory_budget_) {
+        // Whichever tile has been out of view the longest
+        auto victim = resident_.end();
+        for (auto it = resident_.begin(); it != resident_.end(); ++it) {
+            if (it->second.last_near < near_tick_ &&
+                (victim == resident_.end() ||
+                 it->second.last_near < victim->second.last_near)) {
+                victim = it;
+            }
+        }
+        if (victim == resident_.end()) {
+            break;
+        }
+        evict_tile(victim->first);
+    }
+}
+
+void canvas::update_resident_tiles()
+{
+    if (!store_) {
+        return;
+    }
+    const auto visible = visible_area();
+    const auto ts = store_->tile_size();
+    const auto near = visible.adjusted(-ts, -ts, ts, ts);
+    ++near_tick_;
+    for (const auto& [t, info] : store_->index()) {
+        if (!info.bounds.intersects(near)) {
+            continue;
+        }
+        if (auto it = resident_.find(t); it != resident_.end()) {
+            it->second.last_near = near_tick_;
+        }
+        else {
+            load_tile(t);
+        }
+    }
+    // Tiles which only exist in memory so far
+    for (auto& [t, tile] : resident_) {
+        if (tile_bounds(t, ts).intersects(near)) {
+            tile.last_near = near_tick_;
+        }
+    }
+    evict_over_budget();
+}
+void canvas::curr_mode(mode m)
+{
+    flush_samples();
+    if (curr_stroke_) {
+        finish_stroke(last_pt);
+    }
+    curr_mode_ = m;
+}
 void canvas::handle_pen_down(const QPointF& at)
 {
-    logger_->trace("handle_pen_down()");
+    SKETCHY_TRACE(logger_, "handle_pen_down()");
     pen_down_ = true;
     apply_custom_cursor();
     switch (curr_mode_) {
@@ -95,7 +549,7 @@ void canvas::handle_pen_down(const QPointF& at)
 }
 void canvas::handle_pen_up(const QPointF& at)
 {
-    logger_->trace("handle_pen_up()");
+    SKETCHY_TRACE(logger_, "handle_pen_up()");
     switch (curr_mode_) {
     case mode::draw:
         if (pen_down_) {
@@ -107,29 +561,32 @@ void canvas::handle_pen_up(const QPointF& at)
 }
 void canvas::handle_pen_move(const QPointF& at)
 {
-    logger_->trace("handle_pen_move()");
+    SKETCHY_TRACE(logger_, "handle_pen_move()");
     if (pen_down_) {
         switch (curr_mode_) {
         case mode::draw:
-            add_stroke(at);
+            if (!curr_stroke_) {
+                prime_stroke(last_pt);
+            }
+            pending_.push_back({at, curr_weight_});
+            pending_times_.push_back(curr_time_);
+            if (!frame_timer_.isActive()) {
+                // Once a frame, straight away if the last was longer ago
+                const auto frame_ms =
+                    1000 / std::max(1.0, screen()->refreshRate());
+                const auto wait = last_flush_ + frame_ms - steady_ms();
+                frame_timer_.start(static_cast<int>(std::max(0.0, wait)));
+            }
             break;
         case mode::erase:
             handle_erase(at);
             break;
         case mode::move:
             const auto diff = last_pt - at;
-            logger_->trace("move: [{}]", diff);
-            QRectF new_size{scene_.sceneRect().topLeft(),
-                            scene_.sceneRect().size() +
-                                QSizeF{diff.x(), diff.y()}};
-            if (!scene_.sceneRect().contains(new_size)) {
-                scene_.setSceneRect(new_size);
-            }
-            viewport_->verticalScrollBar()->setValue(
-                viewport_->verticalScrollBar()->value() + diff.y());
-            viewport_->horizontalScrollBar()->setValue(
-                viewport_->horizontalScrollBar()->value() + diff.x());
-            break;
+            SKETCHY_TRACE(logger_, "move: [{}]", diff);
+            viewport_->pan_by(diff);
+            // The point grabbed is back under the pen, so it stays last_pt
+            return;
         }
 
         last_pt = at;
@@ -141,15 +598,18 @@ auto canvas::eraser_cursor() const -> QCursor
 }
 auto canvas::erasor_cursor_bitmap() const -> QPixmap
 {
-    const auto size = QSizeF{curr_weight_ * 2, curr_weight_ * 2};
+    // The eraser is sized in scene units, so it grows with the zoom
+    const auto zoom = viewport_->zoom();
+    const auto size = QSizeF{curr_weight_ * 2, curr_weight_ * 2} * zoom;
     QPixmap img{size.toSize()};
     fill_with_transparent(img);
-    const auto path =
-        eraser_bounds(QPointF(size.width() / 2, size.height() / 2));
+    const auto path = eraser_bounds(
+        QPointF(size.width() / 2, size.height() / 2) / zoom);
     QPainter p{&img};
+    p.scale(zoom, zoom);
     QPen pen;
     pen.setColor(Qt::black);
-    pen.setWidthF(1);
+    pen.setWidthF(1 / zoom);
     p.setPen(pen);
     p.drawPath(path);
     p.end();
@@ -187,22 +647,104 @@ void canvas::on_mouse_leave() const
 
 void canvas::handle_erase(const QPointF& at)
 {
-    logger_->trace("handle_erase()");
-    const auto area = eraser_bounds(at);
-    const auto to_remove = scene_.items(area);
-    if (!to_remove.empty()) {
-        std::for_each(to_remove.begin(), to_remove.end(), [this](auto* item) {
-            scene_.removeItem(item);
-            delete item;
-        });
-        constexpr auto margin = 25;
-        scene_.update(
-            area.boundingRect().adjusted(-margin, -margin, margin, margin));
-        logger_->debug("erased {} items", to_remove.size());
+    SKETCHY_TRACE(logger_, "handle_erase()");
+    const metrics::scoped_timer timer{metrics::timing::erase};
+    const auto r = static_cast<double>(curr_weight_);
+    const QRectF area{at - QPointF{r, r}, QSizeF{r * 2, r * 2}};
+
+    // Work out everything first, then apply it all in one go
+    std::vector<stroke*> erased;
+    std::vector<detail::stroke> pieces;
+    // Stacking order of the stroke each piece was cut from
+    std::vector<stroke_id> orders;
+    for (const auto& span : grid_.query(area)) {
+        // The live stroke is not in the document yet
+        const auto i = doc_.find(span.id);
+        if (i == doc_.size()) {
+            continue;
+        }
+        auto left =
+            erase_circle(doc_.view(i), span, at, r, split_on_erase_);
+        if (left) {
+            erased.emplace_back(by_id_.at(span.id));
+            orders.insert(orders.end(), left->size(), doc_.order(i));
+            std::move(left->begin(), left->end(), std::back_inserter(pieces));
+        }
     }
-    else {
-        logger_->trace("nothing to remove at: [{}]", at);
+    if (erased.empty()) {
+        SKETCHY_TRACE(logger_, "nothing to remove at: [{}]", at);
+        return;
+    }
+
+    QRectF dirty;
+    for (auto* s : erased) {
+        dirty = dirty.united(s->boundingRect());
     }
+    changeset change;
+    change.erased.reserve(erased.size());
+    for (auto* s : erased) {
+        change.erased.push_back(s->id());
+    }
+    remove_items(erased);
+    change.added.reserve(pieces.size());
+    for (std::size_t k = 0; k != pieces.size(); ++k) {
+        // New ids, but in the place of the stroke they were cut from
+        const auto id = next_id_++;
+        doc_.add(id, pieces[k], orders[k]);
+        commit_item(add_item(id));
+        change.added.push_back({id, std::move(pieces[k]), orders[k]});
+    }
+    scene_.update(dirty);
+    emit changed(change);
+    SKETCHY_DEBUG(logger_, "erased {} strokes, {} pieces left",
+                  erased.size(), pieces.size());
+}
+void canvas::split_on_erase(bool split) { split_on_erase_ = split; }
+void canvas::predict_ink(bool on)
+{
+    predict_ink_ = on;
+    if (!on && curr_stroke_) {
+        curr_stroke_->predict({});
+    }
+}
+void canvas::simplify_tolerance(double px) { simplify_tolerance_ = px; }
+
+canvas_view::canvas_view(QGraphicsScene* scene) : QGraphicsView{scene}
+{
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    update_window();
+}
+auto canvas_view::map_to_scene(const QPointF& p) const -> QPointF
+{
+    return viewportTransform().inverted().map(p);
+}
+void canvas_view::zoom_by(double factor, const QPointF& anchor)
+{
+    const auto old = zoom();
+    const auto scale = std::clamp(old * factor, min_zoom, max_zoom);
+    if (scale == old) {
+        return;
+    }
+    const auto fixed = top_left_ + anchor / old;
+    top_left_ = fixed - anchor / scale;
+    setTransform(QTransform::fromScale(scale, scale));
+    update_window();
+}
+void canvas_view::pan_by(const QPointF& d) { pan_to(top_left_ + d); }
+void canvas_view::pan_to(const QPointF& top_left)
+{
+    top_left_ = top_left;
+    update_window();
+}
+void canvas_view::update_window()
+{
+    // Exactly what fits in the viewport, so there is nothing to scroll
+    const auto scale = transform().m11();
+    const QSizeF size{viewport()->width() / scale,
+                      viewport()->height() / scale};
+    setSceneRect(QRectF{top_left_, size});
+    emit visible_area_changed();
 }
 
 void canvas_view::mouseReleaseEvent(QMouseEvent* e)
@@ -228,6 +770,97 @@ void canvas_view::mousePressEvent(QMouseEvent* e)
     }
 }
 
+void canvas_view::wheelEvent(QWheelEvent* e)
+{
+    if (!e->modifiers().testFlag(Qt::ControlModifier)) {
+        QGraphicsView::wheelEvent(e);
+        return;
+    }
+    zoom_by(std::pow(wheel_zoom_step, e->angleDelta().y() / 120.0),
+            e->position());
+    e->accept();
+}
+
+void canvas_view::render_vector(QPainter* to, const QRectF& target)
+{
+    direct_ink_ = true;
+    render(to, target);
+    direct_ink_ = false;
+}
+void canvas_view::input_arrived(double at)
+{
+    if (input_at_ == 0) {
+        input_at_ = at;
+    }
+}
+void canvas_view::paintEvent(QPaintEvent* e)
+{
+    {
+        const metrics::scoped_timer timer{metrics::timing::paint};
+        QGraphicsView::paintEvent(e);
+    }
+    if (input_at_ != 0) {
+        metrics::get(metrics::timing::event_to_frame)
+            .record(to_us(steady_ms() - input_at_));
+        input_at_ = 0;
+    }
+}
+void canvas_view::drawBackground(QPainter* p, const QRectF& rect)
+{
+    QGraphicsView::drawBackground(p, rect);
+    if (!ink_) {
+        return;
+    }
+    if (direct_ink_) {
+        ink_->draw_direct(*p, rect);
+    }
+    else {
+        ink_->draw(*p, rect, p->worldTransform().m11() * devicePixelRatioF());
+    }
+}
+
+void canvas_view::set_overlay(const QString& text)
+{
+    if (text != overlay_) {
+        overlay_ = text;
+        viewport()->update();
+    }
+}
+void canvas_view::drawForeground(QPainter* p, const QRectF& rect)
+{
+    QGraphicsView::drawForeground(p, rect);
+    if (overlay_.isEmpty()) {
+        return;
+    }
+    // In viewport pixels, whatever the zoom
+    p->save();
+    p->resetTransform();
+    p->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    const auto margin = 6;
+    const auto box = p->fontMetrics()
+                         .boundingRect(QRect{0, 0, width(), height()},
+                                       Qt::AlignLeft | Qt::AlignTop,
+                                       overlay_)
+                         .translated(margin, margin);
+    p->fillRect(box.adjusted(-margin / 2, -margin / 2, margin / 2,
+                             margin / 2),
+                QColor{255, 255, 255, 200});
+    p->setPen(Qt::black);
+    p->drawText(box, Qt::AlignLeft | Qt::AlignTop, overlay_);
+    p->restore();
+}
+
+void canvas_view::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    emit visible_area_changed();
+}
+void canvas_view::resizeEvent(QResizeEvent* e)
+{
+    QGraphicsView::resizeEvent(e);
+    update_window();
+}
+
 bool canvas_scene::event(QEvent* e)
 {
     if (e->type() == QEvent::Enter) {
@@ -256,6 +889,11 @@ bool canvas_view::event(QEvent* e)
 }
 void canvas::on_canvas_event(QPointerEvent* pe)
 {
+    if (ids_pending_) {
+        return;
+    }
+    const metrics::scoped_timer timer{metrics::timing::input};
+    metrics::add(metrics::counter::events);
     if (pe->deviceType() == QInputDevice::DeviceType::Mouse) {
         if (auto* ev = dynamic_cast<QMouseEvent*>(pe)) {
             if (ev->button() == Qt::MouseButton::RightButton) {
@@ -264,68 +902,414 @@ void canvas::on_canvas_event(QPointerEvent* pe)
         }
     }
     for (const auto& pt : pe->points()) {
-        const auto pos = viewport_->mapToScene(pt.position().toPoint());
+        const auto pos = viewport_->map_to_scene(pt.position());
+        const auto arrived = steady_ms();
+        // Synthesised events can come without a timestamp
+        curr_time_ = pt.timestamp() != 0
+                         ? static_cast<double>(pt.timestamp())
+                         : arrived;
+        if (pt.timestamp() != 0) {
+            // Timestamps are on the window system's clock, so only how much
+            // later than the quickest event this one arrived is known
+            const auto offset = arrived - curr_time_;
+            min_event_offset_ = std::min(min_event_offset_, offset);
+            metrics::get(metrics::timing::delivery)
+                .record(to_us(offset - min_event_offset_));
+        }
+        if (pen_down_ || pt.state() == QEventPoint::State::Pressed) {
+            viewport_->input_arrived(arrived);
+        }
         if (pen_down_) {
             curr_weight_ = pt.pressure() * weight_scaling_;
-            logger_->debug("recorded pressure: {}", curr_weight_);
+            SKETCHY_TRACE(logger_, "recorded pressure: {}", curr_weight_);
         }
         switch (pt.state()) {
         case QEventPoint::State::Pressed:
+            flush_samples();
+            last_kept_ = pos;
+            last_kept_time_ = curr_time_;
             handle_pen_down(pos);
             break;
         case QEventPoint::State::Released:
+            flush_samples();
             handle_pen_up(pos);
             break;
         case QEventPoint::State::Updated:
-            handle_pen_move(pos);
+            if (keep_sample(pos)) {
+                handle_pen_move(pos);
+            }
+            else {
+                metrics::add(metrics::counter::dropped_samples);
+            }
             break;
         default:
             break;
         }
     }
 }
-void canvas::prime_stroke(const QPointF& at) {}
+void canvas::prime_stroke(const QPointF& at)
+{
+    detail::stroke s{curr_pen_.color()};
+    s.append({at, curr_weight_});
+    // Drawn as a vector overlay until it is finished
+    curr_stroke_ = items_.make(std::move(s), next_id_++);
+    place_item(curr_stroke_, curr_stroke_->id());
+    predictor_.reset();
+    predictor_.add(curr_time_, {at, curr_weight_});
+}
 template<typename T>
 constexpr auto diff(T lhs, T rhs) -> T
 {
     return lhs > rhs ? lhs - rhs : rhs - lhs;
 }
 
-void canvas::finish_stroke(const QPointF& at) {}
-void canvas::add_stroke(const QPointF& at)
+void canvas::finish_stroke(const QPointF& at)
 {
-    auto* s = new stroke{{
-        last_pt,
-        at,
-        curr_weight_,
-        Qt::black,
-    }};
-
-    scene_.addItem(s);
-    logger_->trace("add line: [{}] -> [{}]", last_pt, at);
+    if (!curr_stroke_) {
+        return;
+    }
+    if (curr_stroke_->live().points.back().pos != at) {
+        const detail::stroke::point last{at, curr_weight_};
+        curr_stroke_->append({&last, 1});
+    }
+    // Tolerance is in device pixels, so it scales with the view
+    const auto px = viewport_->transform().m11() *
+                    viewport_->devicePixelRatioF();
+    curr_stroke_->seal(doc_, simplify_tolerance_ / px);
+    settle_item(curr_stroke_);
+    scene_.update(curr_stroke_->boundingRect());
+    commit_item(curr_stroke_);
+    SKETCHY_TRACE(logger_, "finished stroke with {} points",
+                  curr_stroke_->view().size());
+    changeset change;
+    change.added.push_back(
+        {curr_stroke_->id(), curr_stroke_->view().to_stroke()});
+    emit changed(change);
+    curr_stroke_ = nullptr;
+}
+auto canvas::keep_sample(const QPointF& at) -> bool
+{
+    const auto d = at - last_kept_;
+    const auto px = std::hypot(d.x(), d.y()) *
+                    viewport_->transform().m11() *
+                    viewport_->devicePixelRatioF();
+    // Tablets report far faster than the pen moves, repeats add nothing
+    if (px == 0 || (px < min_sample_px &&
+                    curr_time_ - last_kept_time_ < sample_hold_ms)) {
+        return false;
+    }
+    last_kept_ = at;
+    last_kept_time_ = curr_time_;
+    return true;
+}
+void canvas::flush_samples()
+{
+    frame_timer_.stop();
+    last_flush_ = steady_ms();
+    if (!curr_stroke_) {
+        // The stroke went with the document it was drawn on
+        pending_.clear();
+        pending_times_.clear();
+        return;
+    }
+    if (pending_.empty()) {
+        return;
+    }
+    // Everything queued belongs to the live stroke, it is finished only
+    // after a flush
+    for (std::size_t i = 0; i != pending_.size(); ++i) {
+        predictor_.add(pending_times_[i], pending_[i]);
+    }
+    curr_stroke_->append(pending_);
+    metrics::add(metrics::counter::batches);
+    if (predict_ink_) {
+        predictor_.predict(predict_horizon_ms, predicted_);
+        curr_stroke_->predict(predicted_);
+    }
+    SKETCHY_TRACE(logger_, "added {} points in one frame", pending_.size());
+    pending_.clear();
+    pending_times_.clear();
 }
 
 auto canvas::strokes() const -> std::vector<detail::stroke>
 {
+    if (!store_) {
+        return doc_.strokes();
+    }
     std::vector<detail::stroke> strokes;
-    for (const auto* w : scene_.items()) {
-        if (auto* s = dynamic_cast<const stroke*>(w)) {
-            strokes.emplace_back(s->underlying());
-        }
+    for (auto& s : stored_strokes()) {
+        strokes.emplace_back(std::move(s.data));
     }
     return strokes;
 }
 
-canvas::stroke::stroke(detail::stroke data) : data_{std::move(data)}
+auto canvas::stored_strokes() const -> std::vector<stored_stroke>
+{
+    auto out = doc_.stored();
+    if (store_) {
+        // Everything that is not paged in has to come from the store
+        for (const auto& [t, info] : store_->index()) {
+            if (!resident_.contains(t)) {
+                auto tile = store_->load(t);
+                std::move(tile.begin(), tile.end(), std::back_inserter(out));
+            }
+        }
+        std::sort(out.begin(), out.end(), [](const auto& l, const auto& r) {
+            return std::pair{l.order(), l.id} < std::pair{r.order(), r.id};
+        });
+    }
+    return out;
+}
+auto canvas::snapshot() const -> document
+{
+    auto out = doc_;
+    if (store_) {
+        // Tiles which are not paged in have to be read anyway
+        for (const auto& [t, info] : store_->index()) {
+            if (!resident_.contains(t)) {
+                out.add(store_->load(t));
+            }
+        }
+    }
+    return out;
+}
+auto canvas::deferred_snapshot() const -> std::function<document()>
+{
+    std::vector<tile_coord> paged_out;
+    if (store_) {
+        for (const auto& [t, info] : store_->index()) {
+            if (!resident_.contains(t)) {
+                paged_out.push_back(t);
+            }
+        }
+    }
+    return [doc = doc_, store = store_, paged_out]() mutable {
+        for (const auto t : paged_out) {
+            doc.add(store->load(t));
+        }
+        paged_out.clear();
+        return doc;
+    };
+}
+auto canvas::unsaved_changes() const -> changeset
+{
+    changeset c;
+    c.erased = unsaved_erased_;
+    c.added.reserve(unsaved_added_.size());
+    for (const auto id : unsaved_added_) {
+        c.added.push_back(doc_.get(id).to_stored());
+    }
+    // Keep the stacking order on replay
+    std::sort(c.added.begin(), c.added.end(),
+              [](const auto& l, const auto& r) {
+                  return std::pair{l.order(), l.id} <
+                         std::pair{r.order(), r.id};
+              });
+    return c;
+}
+void canvas::mark_saved()
+{
+    unsaved_added_.clear();
+    unsaved_erased_.clear();
+}
+void canvas::mark_saved(const changeset& saved)
+{
+    for (const auto& s : saved.added) {
+        unsaved_added_.erase(s.id);
+    }
+    const std::unordered_set<stroke_id> erased{saved.erased.begin(),
+                                               saved.erased.end()};
+    std::erase_if(unsaved_erased_,
+                  [&erased](stroke_id id) { return erased.contains(id); });
+}
+void canvas::mark_unsaved(const changeset& failed)
+{
+    for (const auto& s : failed.added) {
+        // Erased since, which was recorded as erasing a saved stroke
+        if (auto it = std::find(unsaved_erased_.begin(), unsaved_erased_.end(),
+                                s.id);
+            it != unsaved_erased_.end()) {
+            unsaved_erased_.erase(it);
+        }
+        else if (doc_.contains(s.id)) {
+            unsaved_added_.emplace(s.id);
+        }
+    }
+    unsaved_erased_.insert(unsaved_erased_.end(), failed.erased.begin(),
+                           failed.erased.end());
+}
+void canvas::apply(const changeset& c)
+{
+    std::unordered_set<stroke_id> missing;
+    for (const auto id : c.erased) {
+        if (!by_id_.contains(id)) {
+            missing.insert(id);
+        }
+    }
+    if (store_ && !missing.empty()) {
+        // Erased strokes may be paged out, so page tiles in until they are
+        // all found. Evicting them again is left to the next view change
+        for (const auto& [t, info] : store_->index()) {
+            if (missing.empty()) {
+                break;
+            }
+            if (resident_.contains(t)) {
+                continue;
+            }
+            load_tile(t);
+            std::erase_if(missing,
+                          [this](stroke_id id) { return by_id_.contains(id); });
+        }
+    }
+    std::vector<stroke*> gone;
+    for (const auto id : c.erased) {
+        if (auto it = by_id_.find(id); it != by_id_.end()) {
+            gone.push_back(it->second);
+        }
+    }
+    QRectF dirty;
+    for (auto* s : gone) {
+        dirty = dirty.united(s->boundingRect());
+    }
+    remove_items(gone);
+    std::vector<stored_stroke> added;
+    for (const auto& s : c.added) {
+        if (!doc_.contains(s.id)) {
+            added.push_back(s);
+            next_id_ = std::max(next_id_, s.id + 1);
+        }
+    }
+    doc_.add(added);
+    dirty = dirty.united(add_items(added));
+    for (const auto& s : added) {
+        commit_item(by_id_.at(s.id));
+    }
+    scene_.update(dirty);
+}
+
+canvas::stroke::stroke(detail::stroke data, stroke_id id)
+    : live_{std::move(data)}, id_{id}, bounds_{live_.bounds()}
+{
+    for (const auto& pt : live_.points) {
+        live_outline_.add(pt.pos, pt.weight);
+    }
+}
+
+canvas::stroke::stroke(const document& doc, const stroke_view& s)
+    : doc_{&doc}, id_{s.id}, bounds_{s.bounds}
+{
+    // Painted through the ink cache, set before it is in a scene so that
+    // nothing is notified
+    setFlag(QGraphicsItem::ItemHasNoContents);
+}
+
+void canvas::stroke::append(std::span<const detail::stroke::point> pts)
+{
+    if (pts.empty()) {
+        return;
+    }
+    // The end before pts becomes a join, which can reach as far as its cap
+    // did
+    const auto prev = live_.empty() ? pts.front() : live_.points.back();
+    auto j = prev.weight / 2.0;
+    auto x0 = prev.pos.x();
+    auto x1 = x0;
+    auto y0 = prev.pos.y();
+    auto y1 = y0;
+    auto grown = bounds_;
+    for (const auto& pt : pts) {
+        live_.append(pt);
+        live_outline_.add(pt.pos, pt.weight);
+        const auto m = pt.weight / 2.0;
+        const auto pt_bounds =
+            QRectF{pt.pos, QSizeF{}}.adjusted(-m, -m, m, m);
+        grown = grown.isNull() ? pt_bounds : grown.united(pt_bounds);
+        j = std::max(j, m);
+        x0 = std::min(x0, pt.pos.x());
+        x1 = std::max(x1, pt.pos.x());
+        y0 = std::min(y0, pt.pos.y());
+        y1 = std::max(y1, pt.pos.y());
+    }
+    outline_stale_ = true;
+    if (grown != bounds_) {
+        prepareGeometryChange();
+        bounds_ = grown;
+    }
+    update(QRectF{QPointF{x0 - j, y0 - j}, QPointF{x1 + j, y1 + j}});
+}
+
+void canvas::stroke::seal(document& doc, double tolerance)
+{
+    predict({});
+    // Only ever drops points, so the bounds grown while drawing still hold
+    doc.add(id_, simplify(live_, tolerance));
+    live_ = detail::stroke{};
+    live_outline_ = outline_builder{};
+    doc_ = &doc;
+    // Simplified, so worked out again from the document when next needed
+    outline_ = QPolygonF{};
+    outline_stale_ = true;
+    lod_.clear();
+    lod_stale_ = true;
+}
+
+void canvas::stroke::predict(const std::vector<detail::stroke::point>& tail)
+{
+    const auto old = tail_bounds_;
+    tail_.clear();
+    tail_outline_.clear();
+    tail_bounds_ = QRectF{};
+    if (!tail.empty() && !live_.empty()) {
+        const auto& from = live_.points.back();
+        tail_.add(from.pos, from.weight);
+        for (const auto& pt : tail) {
+            tail_.add(pt.pos, pt.weight);
+        }
+        tail_.build(tail_outline_);
+        tail_bounds_ = tail_outline_.boundingRect();
+    }
+    const auto outside = [this](const QRectF& r) {
+        return !r.isNull() && !bounds_.contains(r);
+    };
+    if (outside(old) || outside(tail_bounds_)) {
+        prepareGeometryChange();
+    }
+    update(old.united(tail_bounds_));
+}
+
+auto canvas::stroke::outline() const -> const QPolygonF&
+{
+    if (outline_stale_) {
+        if (doc_) {
+            stroke_outline(doc_->get(id_), outline_);
+        }
+        else {
+            live_outline_.build(outline_);
+        }
+        outline_stale_ = false;
+    }
+    return outline_;
+}
+auto canvas::stroke::outline(double scale) const -> const QPolygonF&
+{
+    const auto level = lod_level(scale);
+    if (level < 0 || !doc_) {
+        return outline();
+    }
+    if (lod_stale_) {
+        lod_.build(view());
+        lod_stale_ = false;
+    }
+    return lod_.levels() == 0 ? outline()
+                              : lod_.outline(static_cast<std::size_t>(level));
+}
+
+void canvas::stroke::paint(QPainter* p, const QStyleOptionGraphicsItem*,
+                           QWidget*)
 {
-    setLine(QLineF{data_.start, data_.end});
-    QPen p;
-    p.setColor(data_.colour);
-    p.setWidthF(data_.weight);
-    p.setMiterLimit(8);
-    p.setCapStyle(Qt::PenCapStyle::RoundCap);
-    p.setStyle(Qt::PenStyle::SolidLine);
-    p.setJoinStyle(Qt::PenJoinStyle::RoundJoin);
-    setPen(p);
+    const auto colour = doc_ ? doc_->get(id_).colour : live_.colour;
+    outline_painter painter{*p};
+    painter.paint(outline(), colour);
+    painter.paint(tail_outline_, colour);
 }
 } // namespace sketchy::ui
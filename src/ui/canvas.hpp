@@ -22,27 +22,91 @@
 #include <qgraphicsitem.h>
 #include <qgraphicsview.h>
 #include <qpainter.h>
+#include <qpainterpath.h>
 #include <qpoint.h>
+#include <qtimer.h>
 #include <qwidget.h>
 
+#include <functional>
+#include <limits>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "document.hpp"
+#include "eraser.hpp"
+#include "journal.hpp"
+#include "lod.hpp"
 #include "logger.hpp"
+#include "memory_stats.hpp"
+#include "outline.hpp"
+#include "predictor.hpp"
 #include "storage.hpp"
+#include "tile_store.hpp"
+#include "ui/ink_cache.hpp"
+#include "ui/item_arena.hpp"
+#include "ui/paint.hpp"
 
 class QGraphicsView;
 namespace sketchy::ui {
 
+/// View onto an unbounded scene. There are no scrollbars, the view is a
+/// window the size of the viewport from a corner point, so panning costs
+/// the same however far it goes
 class canvas_view : public QGraphicsView {
     Q_OBJECT
 public:
-    using QGraphicsView::QGraphicsView;
+    explicit canvas_view(QGraphicsScene* scene);
+
+    /// Move what is shown by d, in scene units
+    void pan_by(const QPointF& d);
+    /// Show the scene from top_left, which stays put when resized
+    void pan_to(const QPointF& top_left);
+    auto top_left() const -> QPointF { return top_left_; }
+    /// Scale the view by factor, keeping the scene point under anchor, in
+    /// viewport pixels, where it is. Clamped to min_zoom and max_zoom
+    void zoom_by(double factor, const QPointF& anchor);
+    /// Viewport pixels per scene unit
+    auto zoom() const -> double { return transform().m11(); }
+    /// Like mapToScene() but keeps the fraction of a pixel which tablets
+    /// report
+    auto map_to_scene(const QPointF& p) const -> QPointF;
+
+    /// Finished ink is drawn from here as part of the background
+    void set_ink_cache(ink_cache* c) { ink_ = c; }
+    /// Render with the ink painted as vectors rather than cached tiles
+    void render_vector(QPainter* to, const QRectF& target);
+    /// Text drawn over the top left of the view, empty for none
+    void set_overlay(const QString& text);
+    /// Input which should change what is shown arrived at this steady clock
+    /// time in ms. The next frame painted counts as showing it
+    void input_arrived(double at);
 
 protected:
+    void drawBackground(QPainter* p, const QRectF& rect) override;
+    void drawForeground(QPainter* p, const QRectF& rect) override;
+    void paintEvent(QPaintEvent* e) override;
     bool event(QEvent* e) override;
     void mouseReleaseEvent(QMouseEvent* e) override;
     void mouseMoveEvent(QMouseEvent* e) override;
     void mousePressEvent(QMouseEvent* e) override;
+    void wheelEvent(QWheelEvent* e) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void resizeEvent(QResizeEvent* e) override;
 signals:
     void on_pointer_event(QPointerEvent* ev) const;
+    void visible_area_changed() const;
+
+private:
+    void update_window();
+
+    ink_cache* ink_{nullptr};
+    bool direct_ink_{false};
+    QPointF top_left_;
+    QString overlay_;
+    /// Earliest input not shown yet, 0 for none
+    double input_at_{0};
 };
 class canvas_scene : public QGraphicsScene {
     Q_OBJECT
@@ -56,16 +120,76 @@ signals:
     void on_mouse_enter() const;
     void on_mouse_leave() const;
 };
+
+/// Copies of the notebook tiles changed since they were last written
+struct tile_writes {
+    std::shared_ptr<tile_store> store;
+    std::vector<std::pair<tile_coord, std::vector<stored_stroke>>> tiles;
+    std::uint64_t when{0};
+
+    /// Store the tiles and flush the store, on any thread
+    void write() const;
+};
+
 class canvas : public QWidget {
     Q_OBJECT
-    class stroke : public QGraphicsLineItem {
+    /// One item per pen-down. Owns its points while drawing, then on pen-up
+    /// they are sealed into the document and the item only views them
+    class stroke : public QGraphicsItem {
     public:
-        stroke(detail::stroke data);
+        /// Live stroke being drawn
+        stroke(detail::stroke data, stroke_id id);
+        /// Finished stroke s, which is in doc
+        stroke(const document& doc, const stroke_view& s);
+
+        /// Grows the bounds and asks for a repaint once for all of pts
+        void append(std::span<const detail::stroke::point> pts);
+        /// Simplify to within tolerance and move the points into doc
+        void seal(document& doc, double tolerance);
+
+        /// Points of a live stroke, empty once sealed
+        auto live() const -> const detail::stroke& { return live_; }
+        /// Only valid once sealed
+        auto view() const -> stroke_view { return doc_->get(id_); }
+        auto id() const -> stroke_id { return id_; }
+        /// Worked out when first asked for and kept until the points
+        /// change. Only the end is redone as a live stroke grows
+        auto outline() const -> const QPolygonF&;
+        /// Outline detailed enough for scale device pixels per scene unit,
+        /// from a pyramid built the first time a coarse one is asked for
+        auto outline(double scale) const -> const QPolygonF&;
+        /// Heap bytes of the full outline if it has been worked out
+        auto outline_bytes() const -> std::size_t
+        {
+            return static_cast<std::size_t>(outline_.capacity()) *
+                   sizeof(QPointF);
+        }
+        auto lod() const -> const stroke_lod& { return lod_; }
+        /// Draw tail on from the last point of a live stroke, replacing the
+        /// tail drawn before. It is never stored, an empty tail removes it
+        void predict(const std::vector<detail::stroke::point>& tail);
 
-        auto underlying() const -> const detail::stroke& { return data_; }
+        auto boundingRect() const -> QRectF override
+        {
+            return tail_bounds_.isNull() ? bounds_
+                                         : bounds_.united(tail_bounds_);
+        }
+        void paint(QPainter* p, const QStyleOptionGraphicsItem*,
+                   QWidget*) override;
 
     private:
-        detail::stroke data_;
+        const document* doc_{nullptr};
+        detail::stroke live_;
+        stroke_id id_;
+        QRectF bounds_;
+        outline_builder live_outline_;
+        mutable QPolygonF outline_;
+        mutable bool outline_stale_{true};
+        mutable stroke_lod lod_;
+        mutable bool lod_stale_{true};
+        outline_builder tail_;
+        QPolygonF tail_outline_;
+        QRectF tail_bounds_;
     };
 
 public:
@@ -75,31 +199,148 @@ public:
         erase,
     };
     explicit canvas(logger_t logger);
+    ~canvas() override;
 
     void curr_mode(mode m);
 
     auto strokes() const -> std::vector<detail::stroke>;
     void set_strokes(const std::vector<detail::stroke>&);
+    void set_strokes(const std::vector<stored_stroke>&);
+    /// Clear the canvas for a document arriving in batches. Pen input is
+    /// ignored until the first batch says which ids are taken, and the
+    /// scene is not indexed until end_load()
+    void begin_load();
+    /// Add a batch of a document being loaded, next_id is higher than every
+    /// id in the whole document
+    void add_loaded(const std::vector<stored_stroke>& batch,
+                    stroke_id next_id);
+    /// Index everything loaded in one go
+    void end_load();
+
+    /// Every finished stroke along with its id, in stacking order
+    auto stored_strokes() const -> std::vector<stored_stroke>;
+    /// Every finished stroke, sharing their points rather than copying
+    /// them so it can be handed to another thread
+    auto snapshot() const -> document;
+    /// snapshot() with the notebook tiles which are not paged in left to
+    /// the returned function, which can be called on another thread
+    auto deferred_snapshot() const -> std::function<document()>;
+    /// Strokes finished and erased since the last mark_saved()
+    auto unsaved_changes() const -> changeset;
+    auto has_unsaved_changes() const -> bool
+    {
+        return !unsaved_added_.empty() || !unsaved_erased_.empty();
+    }
+    void mark_saved();
+    /// Mark only what is in saved, for a save which finishes later while
+    /// the canvas keeps changing. Undo it with mark_unsaved() if it fails
+    void mark_saved(const changeset& saved);
+    void mark_unsaved(const changeset& failed);
+    /// Replay c, recorded as unsaved. Strokes already here and erased ids
+    /// which are not are skipped, so replaying over a document which
+    /// already has some of it is harmless. Notebook tiles are paged in to
+    /// find erased strokes which are not resident
+    void apply(const changeset& c);
+
+    /// Page strokes in from store as they come near the view, replacing
+    /// whatever is on the canvas now
+    void open_store(std::shared_ptr<tile_store> store);
+    auto has_store() const -> bool { return store_ != nullptr; }
+    /// Copy out every modified resident tile and mark it written. Until
+    /// end_tile_writes() they are written again if evicted, ordered after
+    /// w so it cannot undo that
+    auto begin_tile_writes() -> tile_writes;
+    /// Mark the tiles modified again if writing them failed
+    void end_tile_writes(const tile_writes& w, bool written);
+    /// Resident tiles away from the view are evicted past this many bytes
+    void memory_budget(std::size_t bytes);
+    /// Cut strokes at the edge of the eraser rather than removing them whole
+    void split_on_erase(bool split);
+    /// Finished strokes drop points within this many device pixels of the
+    /// line through their neighbours, 0 keeps every point
+    void simplify_tolerance(double px);
+    /// Draw where the pen is heading ahead of the live stroke, so ink
+    /// appears under the pen sooner
+    void predict_ink(bool on);
+    /// Add the pen moves queued for the next frame to the live stroke now
+    void flush_samples();
+    /// How well prediction has done since the canvas was made
+    auto prediction() const -> const prediction_stats&
+    {
+        return predictor_.stats();
+    }
 
+    /// Scale the view by factor about its centre
+    void zoom_by(double factor);
+    /// Back to one viewport pixel per scene unit
+    void reset_zoom();
+    /// Counts and heap bytes of the document, items and caches, walking
+    /// every item
+    auto memory() const -> memory_stats;
+    /// Text drawn over the canvas, for debugging
+    void debug_overlay(const QString& text);
+    /// Scene area currently on screen
+    auto visible_area() const -> QRectF;
     void print_area(QPainter& to, const QRectF& area) const;
     auto scene_size() const -> QSizeF;
 signals:
     void content_menu_wanted(const QPointF&);
+    /// A stroke was finished or erased, emitted once per pen action
+    void changed(const sketchy::changeset& c);
 
 private slots:
     void on_canvas_event(QPointerEvent* e);
     void on_mouse_enter() const;
     void on_mouse_leave() const;
+    void update_resident_tiles();
 
 protected:
 private:
     void apply_custom_cursor() const;
     void clear_custom_cursor() const;
 
-    void add_stroke(const QPointF& at);
     void prime_stroke(const QPointF& at);
+    /// Forget the live stroke and anything queued for it, its item is
+    /// about to go
+    void drop_live_stroke();
     void finish_stroke(const QPointF& at);
 
+    /// Item for a stroke which is already in the document
+    auto add_item(stroke_id id) -> stroke*;
+    /// Items for strokes which are already in the document, returns the
+    /// area they cover
+    auto add_items(const std::vector<stored_stroke>& strokes) -> QRectF;
+    /// Delete every item without recording anything as erased
+    void destroy_items();
+    /// Add s to the scene at its place in the stacking order
+    void place_item(stroke* s, stroke_id order);
+    /// Hand a finished stroke over to the ink cache and eraser index
+    void settle_item(stroke* s);
+    /// Record a new finished stroke as unsaved
+    void commit_item(stroke* s);
+    void remove_items(const std::vector<stroke*>& items);
+    /// Delete items and their strokes without recording them as erased
+    void drop_items(const std::vector<stroke*>& items);
+
+    struct resident_tile {
+        std::unordered_set<stroke*> items;
+        std::size_t bytes{0};
+        std::uint64_t last_near{0};
+        bool dirty{false};
+        /// Part of the tile_writes in flight
+        bool writing{false};
+    };
+    void track_item(stroke* s, bool dirty);
+    void untrack_item(stroke* s);
+    void load_tile(tile_coord t);
+    void evict_tile(tile_coord t);
+    void evict_over_budget();
+    auto tile_strokes(const resident_tile& t) const
+        -> std::vector<stored_stroke>;
+
+    /// Paint every finished stroke in area, used to fill the ink cache
+    void render_ink(QPainter& p, const QRectF& area);
+
     void handle_erase(const QPointF& at);
     auto eraser_bounds(const QPointF& center) const -> QPainterPath;
     auto eraser_cursor() const -> QCursor;
@@ -108,15 +349,55 @@ private:
     void handle_pen_down(const QPointF& at);
     void handle_pen_up(const QPointF& at);
     void handle_pen_move(const QPointF& at);
+    /// Whether a pen move is far enough from the last one kept, in space or
+    /// time, to be worth handling
+    auto keep_sample(const QPointF& at) -> bool;
 
     mode curr_mode_{mode::draw};
     logger_t logger_;
     QPointF last_pt;
     QPen curr_pen_;
     bool pen_down_{false};
+    document doc_;
+    std::vector<std::size_t> query_;
+    /// Items live here rather than each being allocated, so they are
+    /// destroyed by the canvas and never by the scene
+    item_arena<stroke> items_;
     canvas_scene scene_;
     canvas_view* viewport_;
+    ink_cache ink_;
+    segment_grid grid_;
+    bool split_on_erase_{true};
+    double simplify_tolerance_{0.25};
+    stroke* curr_stroke_{nullptr};
+    stroke_id next_id_{0};
+    bool ids_pending_{false};
+    std::unordered_map<stroke_id, stroke*> by_id_;
+    std::unordered_set<stroke_id> unsaved_added_;
+    std::vector<stroke_id> unsaved_erased_;
+    std::shared_ptr<tile_store> store_;
+    std::unordered_map<tile_coord, resident_tile> resident_;
+    std::size_t resident_bytes_{0};
+    std::size_t memory_budget_{std::size_t{256} * 1024 * 1024};
+    std::uint64_t near_tick_{0};
+    /// Orders every store of a tile, see tile_store::store()
+    std::uint64_t tile_writes_{0};
     float weight_scaling_{10};
     float curr_weight_{weight_scaling_};
+    /// Time of the sample being handled, in milliseconds
+    double curr_time_{0};
+    bool predict_ink_{false};
+    pen_predictor predictor_;
+    std::vector<detail::stroke::point> predicted_;
+    /// Moves of the live stroke waiting for the next frame, and when each
+    /// was made
+    std::vector<detail::stroke::point> pending_;
+    std::vector<double> pending_times_;
+    QTimer frame_timer_;
+    double last_flush_{0};
+    QPointF last_kept_;
+    double last_kept_time_{0};
+    /// Least seen between an event's timestamp and it arriving
+    double min_event_offset_{std::numeric_limits<double>::infinity()};
 };
 } // namespace sketchy::ui
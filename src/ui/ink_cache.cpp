@@ -0,0 +1,123 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ink_cache.hpp"
+
+#include <cmath>
+
+namespace sketchy::ui {
+
+auto ink_cache::key_hash::operator()(const key& k) const noexcept
+    -> std::size_t
+{
+    const auto xy = (std::uint64_t{static_cast<std::uint32_t>(k.x)} << 32) |
+                    static_cast<std::uint32_t>(k.y);
+    return std::hash<std::uint64_t>{}(xy) ^
+           (std::hash<int>{}(k.level) << 1);
+}
+
+ink_cache::ink_cache(render_fn render) : render_{std::move(render)} {}
+
+auto ink_cache::bytes() const -> std::size_t
+{
+    std::size_t n = 0;
+    for (const auto& [k, t] : tiles_) {
+        n += static_cast<std::size_t>(t.img.sizeInBytes());
+    }
+    return n;
+}
+
+void ink_cache::draw(QPainter& p, const QRectF& exposed, qreal scale)
+{
+    if (!(scale > 0) || exposed.isEmpty()) {
+        return;
+    }
+    const auto level = static_cast<int>(std::lround(std::log2(scale) * 4));
+    const auto bucket_scale = std::exp2(level / 4.0);
+    const auto span = tile_px / bucket_scale;
+
+    const auto cell = [span](qreal v) {
+        return static_cast<std::int32_t>(std::floor(v / span));
+    };
+    const auto x0 = cell(exposed.left());
+    const auto y0 = cell(exposed.top());
+    const auto x1 = cell(exposed.right());
+    const auto y1 = cell(exposed.bottom());
+    ++tick_;
+    for (auto y = y0; y <= y1; ++y) {
+        for (auto x = x0; x <= x1; ++x) {
+            const key k{level, x, y};
+            auto it = tiles_.find(k);
+            if (it == tiles_.end()) {
+                const QRectF area{x * span, y * span, span, span};
+                it = tiles_
+                         .emplace(k, tile{render_tile(area, bucket_scale),
+                                          area, tick_})
+                         .first;
+            }
+            it->second.last_used = tick_;
+            p.drawImage(it->second.area, it->second.img);
+        }
+    }
+    evict_over_limit();
+}
+
+void ink_cache::draw_direct(QPainter& p, const QRectF& exposed) const
+{
+    render_(p, exposed);
+}
+
+void ink_cache::invalidate(const QRectF& area)
+{
+    std::erase_if(tiles_, [&area](const auto& entry) {
+        return entry.second.area.intersects(area);
+    });
+}
+
+auto ink_cache::render_tile(const QRectF& area, qreal scale) const -> QImage
+{
+    QImage img{tile_px, tile_px, QImage::Format_ARGB32_Premultiplied};
+    img.fill(Qt::transparent);
+    QPainter p{&img};
+    p.setRenderHint(QPainter::Antialiasing);
+    p.scale(scale, scale);
+    p.translate(-area.topLeft());
+    p.setClipRect(area);
+    render_(p, area);
+    return img;
+}
+
+void ink_cache::evict_over_limit()
+{
+    while (tiles_.size() > max_tiles_) {
+        // Never throw away something drawn this frame
+        auto victim = tiles_.end();
+        for (auto it = tiles_.begin(); it != tiles_.end(); ++it) {
+            if (it->second.last_used < tick_ &&
+                (victim == tiles_.end() ||
+                 it->second.last_used < victim->second.last_used)) {
+                victim = it;
+            }
+        }
+        if (victim == tiles_.end()) {
+            break;
+        }
+        tiles_.erase(victim);
+    }
+}
+
+} // namespace sketchy::ui
@@ -0,0 +1,87 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <qimage.h>
+#include <qpainter.h>
+#include <qrect.h>
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+namespace sketchy::ui {
+
+/// Raster tiles of finished ink.
+///
+/// Tiles are a fixed number of device pixels square and are kept per zoom
+/// bucket (quarter powers of two), so a tile is only rendered again when
+/// something inside it changes or the zoom moves to a new bucket
+class ink_cache {
+public:
+    /// Paint everything which intersects the area, in scene coordinates
+    using render_fn = std::function<void(QPainter&, const QRectF&)>;
+
+    static constexpr int tile_px = 512;
+
+    explicit ink_cache(render_fn render);
+
+    /// Blit the tiles covering exposed. scale is device pixels per scene unit
+    void draw(QPainter& p, const QRectF& exposed, qreal scale);
+    /// Paint straight through without touching the cache, for printing
+    void draw_direct(QPainter& p, const QRectF& exposed) const;
+
+    /// Drop every tile, at every zoom, which overlaps area
+    void invalidate(const QRectF& area);
+    void clear() { tiles_.clear(); }
+
+    void max_tiles(std::size_t n) { max_tiles_ = n; }
+    auto size() const -> std::size_t { return tiles_.size(); }
+    /// Pixel bytes of every tile held
+    auto bytes() const -> std::size_t;
+
+private:
+    struct key {
+        int level;
+        std::int32_t x;
+        std::int32_t y;
+
+        auto operator==(const key& k) const -> bool
+        {
+            return k.level == level && k.x == x && k.y == y;
+        }
+    };
+    struct key_hash {
+        auto operator()(const key& k) const noexcept -> std::size_t;
+    };
+    struct tile {
+        QImage img;
+        QRectF area;
+        std::uint64_t last_used;
+    };
+
+    auto render_tile(const QRectF& area, qreal scale) const -> QImage;
+    void evict_over_limit();
+
+    render_fn render_;
+    std::unordered_map<key, tile, key_hash> tiles_;
+    std::size_t max_tiles_{96};
+    std::uint64_t tick_{0};
+};
+
+} // namespace sketchy::ui
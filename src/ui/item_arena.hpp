@@ -0,0 +1,103 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace sketchy::ui {
+
+/// Slots for objects of one type, allocated a chunk at a time. Objects made
+/// one after another sit next to each other in memory rather than each
+/// being its own heap allocation, and destroyed slots are reused.
+///
+/// Objects are not destroyed with the arena, everything made must be
+/// destroyed (or the arena reset) by the owner first
+template<typename T>
+class item_arena {
+public:
+    /// Slots added at a time when the arena runs out
+    static constexpr std::size_t chunk_slots = 4096;
+
+    item_arena() = default;
+    item_arena(const item_arena&) = delete;
+    auto operator=(const item_arena&) -> item_arena& = delete;
+
+    template<typename... Args>
+    auto make(Args&&... args) -> T*
+    {
+        if (free_.empty()) {
+            grow(chunk_slots);
+        }
+        auto* at = free_.back();
+        free_.pop_back();
+        ++live_;
+        return new (at) T(std::forward<Args>(args)...);
+    }
+    void destroy(T* p)
+    {
+        p->~T();
+        free_.push_back(reinterpret_cast<slot*>(p));
+        --live_;
+    }
+    /// Make room for n more objects, in one contiguous chunk unless there
+    /// is room already
+    void reserve(std::size_t n)
+    {
+        if (free_.size() < n) {
+            grow(std::max(n, chunk_slots));
+        }
+    }
+    /// Release every chunk. Only valid once nothing made is still alive
+    void reset()
+    {
+        chunks_.clear();
+        free_.clear();
+        capacity_ = 0;
+    }
+
+    auto size() const -> std::size_t { return live_; }
+    auto capacity() const -> std::size_t { return capacity_; }
+
+private:
+    struct alignas(T) slot {
+        std::byte bytes[sizeof(T)];
+    };
+
+    void grow(std::size_t n)
+    {
+        auto& chunk = chunks_.emplace_back(std::make_unique<slot[]>(n));
+        // Handed out front to back
+        for (auto i = n; i-- > 0;) {
+            free_.push_back(&chunk[i]);
+        }
+        capacity_ += n;
+    }
+
+    std::vector<std::unique_ptr<slot[]>> chunks_;
+    std::vector<slot*> free_;
+    std::size_t live_{0};
+    std::size_t capacity_{0};
+};
+
+} // namespace sketchy::ui
@@ -0,0 +1,252 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "loader.hpp"
+#include "tile_store.hpp"
+
+#include <qfile.h>
+#include <qtconcurrentrun.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+namespace sketchy::ui {
+namespace detail {
+auto nearest_first(std::vector<stored_stroke>& strokes, const QRectF& near)
+    -> std::size_t
+{
+    struct keyed {
+        double distance;
+        std::size_t index;
+    };
+    const auto centre = near.center();
+    std::vector<keyed> keys;
+    keys.reserve(strokes.size());
+    std::size_t meeting = 0;
+    for (std::size_t i = 0; i != strokes.size(); ++i) {
+        const auto b = strokes[i].data.bounds();
+        if (b.intersects(near)) {
+            keys.push_back({0, i});
+            ++meeting;
+        }
+        else {
+            const auto d = b.center() - centre;
+            keys.push_back({std::hypot(d.x(), d.y()), i});
+        }
+    }
+    // Stable so equally near strokes keep their stacking order
+    std::stable_sort(keys.begin(), keys.end(),
+                     [](const auto& l, const auto& r) {
+                         return l.distance < r.distance;
+                     });
+    std::vector<stored_stroke> out;
+    out.reserve(strokes.size());
+    for (const auto& k : keys) {
+        out.emplace_back(std::move(strokes[k.index]));
+    }
+    strokes = std::move(out);
+    return meeting;
+}
+} // namespace detail
+
+namespace {
+/// How long strokes meeting the view are held back while decoding, so the
+/// screen fills in a frame at a time
+constexpr std::chrono::milliseconds near_batch_interval{16};
+
+/// Hands strokes over as they are decoded. Those meeting near go out in
+/// batches as they are found, the rest are held back until the whole
+/// document has been read and then follow in order of distance
+class batcher {
+public:
+    batcher(QPromise<load_batch>& promise, const QRectF& near,
+            stroke_id next_id, std::shared_ptr<journal> source)
+        : promise_{promise}, near_{near},
+          sent_{std::chrono::steady_clock::now()}
+    {
+        batch_.next_id = next_id;
+        batch_.source = std::move(source);
+    }
+
+    auto canceled() const -> bool { return promise_.isCanceled(); }
+
+    void add(stored_stroke s)
+    {
+        if (!s.data.bounds().intersects(near_)) {
+            rest_.emplace_back(std::move(s));
+            return;
+        }
+        points_ += s.data.points.size();
+        batch_.strokes.emplace_back(std::move(s));
+        if (points_ >= load_batch_points ||
+            std::chrono::steady_clock::now() - sent_ >= near_batch_interval) {
+            send();
+        }
+    }
+
+    /// Send everything left, once the whole document has been read
+    void finish()
+    {
+        send();
+        detail::nearest_first(rest_, near_);
+        auto it = rest_.begin();
+        while (it != rest_.end() && !canceled()) {
+            for (; it != rest_.end() && points_ < load_batch_points; ++it) {
+                points_ += it->data.points.size();
+                batch_.strokes.emplace_back(std::move(*it));
+            }
+            send();
+        }
+    }
+
+private:
+    void send()
+    {
+        // The first batch goes out even when empty, it carries the source
+        // and lets the canvas take input
+        if (batch_.strokes.empty() && !first_) {
+            return;
+        }
+        const auto next_id = batch_.next_id;
+        promise_.addResult(std::exchange(batch_, load_batch{}));
+        batch_.next_id = next_id;
+        points_ = 0;
+        first_ = false;
+        sent_ = std::chrono::steady_clock::now();
+    }
+
+    QPromise<load_batch>& promise_;
+    QRectF near_;
+    load_batch batch_;
+    std::size_t points_{0};
+    bool first_{true};
+    std::chrono::steady_clock::time_point sent_;
+    std::vector<stored_stroke> rest_;
+};
+
+void read_document(const QString& path, const QRectF& near,
+                   QPromise<load_batch>& promise)
+{
+    QFile f{path};
+    if (!f.open(QFile::ReadOnly)) {
+        throw io_error{"failed to open"};
+    }
+    const auto head = f.peek(16);
+    const std::string_view magic{head.constData(),
+                                 static_cast<std::size_t>(head.size())};
+    // JSON documents are still accepted, binary is only used when the magic
+    // bytes match
+    if (!journal::is_journal(magic) && !is_binary(magic)) {
+        // Parsed in one go, so read straight into the string the parser
+        // takes rather than mapping the file and copying it
+        std::string json(static_cast<std::size_t>(f.size()), '\0');
+        if (f.read(json.data(), f.size()) != f.size()) {
+            throw io_error{"failed to read"};
+        }
+        auto strokes = from_json(json);
+        json = {};
+        batcher out{promise, near, strokes.size(), nullptr};
+        for (std::size_t i = 0; i != strokes.size() && !out.canceled(); ++i) {
+            out.add({i, std::move(strokes[i])});
+        }
+        out.finish();
+        return;
+    }
+
+    QByteArray unmapped;
+    std::string_view data;
+    if (const auto* mapped = f.map(0, f.size())) {
+        data = {reinterpret_cast<const char*>(mapped),
+                static_cast<std::size_t>(f.size())};
+    }
+    else {
+        unmapped = f.readAll();
+        data = {unmapped.constData(),
+                static_cast<std::size_t>(unmapped.size())};
+    }
+    if (journal::is_journal(data)) {
+        auto j = std::make_shared<journal>(path);
+        auto r = j->read(data);
+        batcher out{promise, near, r.next_id(), std::move(j)};
+        while (!out.canceled()) {
+            auto s = r.next();
+            if (!s) {
+                break;
+            }
+            out.add(std::move(*s));
+        }
+        out.finish();
+        return;
+    }
+    // Ids are assigned in file order, which is also the stacking order
+    binary_reader r{data};
+    batcher out{promise, near, r.size(), nullptr};
+    for (stroke_id id = 0; !r.done() && !out.canceled(); ++id) {
+        out.add({id, r.next()});
+    }
+    out.finish();
+}
+} // namespace
+
+auto load_document(QString path, QRectF near) -> QFuture<load_batch>
+{
+    return QtConcurrent::run([path = std::move(path),
+                              near](QPromise<load_batch>& promise) {
+        try {
+            read_document(path, near, promise);
+        }
+        catch (const std::exception& e) {
+            load_batch failed;
+            failed.error = QString::fromUtf8(e.what());
+            promise.addResult(std::move(failed));
+        }
+    });
+}
+
+auto load_snapshot(const QString& path) -> document
+{
+    document doc;
+    QFile f{path};
+    if (!f.open(QFile::ReadOnly)) {
+        throw io_error{"failed to open"};
+    }
+    const auto header = f.read(64);
+    f.close();
+    if (tile_store::is_tile_store(
+            {header.constData(), static_cast<std::size_t>(header.size())})) {
+        tile_store store{path};
+        for (const auto& [t, info] : store.index()) {
+            doc.add(store.load(t));
+        }
+    }
+    else {
+        auto loading = load_document(path, QRectF{});
+        loading.waitForFinished();
+        for (const auto& batch : loading.results()) {
+            if (!batch.error.isEmpty()) {
+                throw bad_document{batch.error.toStdString()};
+            }
+            doc.add(batch.strokes);
+        }
+    }
+    return doc;
+}
+
+} // namespace sketchy::ui
@@ -0,0 +1,65 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "document.hpp"
+#include "journal.hpp"
+
+#include <qfuture.h>
+#include <qrect.h>
+#include <qstring.h>
+
+#include <memory>
+#include <vector>
+
+namespace sketchy::ui {
+
+/// Strokes from a document being loaded
+struct load_batch {
+    std::vector<stored_stroke> strokes;
+    /// Higher than every id in the document
+    stroke_id next_id{0};
+    /// The journal the document was replayed from, on the first batch only
+    std::shared_ptr<journal> source;
+    /// Set instead of strokes when the document could not be read
+    QString error;
+};
+
+/// Points handed over per batch after the first. Small enough that adding
+/// a batch to the canvas fits in a frame
+inline constexpr std::size_t load_batch_points = 64 * 1024;
+
+/// Read and parse the journal, binary or JSON document at path on a worker
+/// thread. Binary documents and journal snapshots are decoded a stroke at a
+/// time, strokes meeting near are sent as they are found and the rest
+/// follow in order of distance from it once decoding is done. The first
+/// batch may be empty. Cancelling the future stops between batches
+auto load_document(QString path, QRectF near) -> QFuture<load_batch>;
+
+/// Read the whole of any document at path, notebooks included, without an
+/// event loop. Throws if it cannot be read
+auto load_snapshot(const QString& path) -> document;
+
+namespace detail {
+/// Reorder strokes so those meeting near come first, then the rest by how
+/// far they are from it. Returns how many meet near
+auto nearest_first(std::vector<stored_stroke>& strokes, const QRectF& near)
+    -> std::size_t;
+} // namespace detail
+
+} // namespace sketchy::ui
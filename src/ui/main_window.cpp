@@ -17,8 +17,12 @@
 
 #include "main_window.hpp"
 #include "canvas.hpp"
+#include "metrics.hpp"
 #include "storage.hpp"
+#include "svg_export.hpp"
+#include "tile_store.hpp"
 #include "ui/radial_menu.hpp"
+#include "ui/raster_export.hpp"
 
 #include <QHBoxLayout>
 #include <fstream>
@@ -26,22 +30,62 @@
 #include <qevent.h>
 #include <qfile.h>
 #include <qfiledialog.h>
+#include <qinputdialog.h>
 #include <qkeysequence.h>
 #include <qmainwindow.h>
 #include <qmenubar.h>
+#include <qmessagebox.h>
+#include <qdir.h>
+#include <qsavefile.h>
 #include <qscreen.h>
+#include <qsettings.h>
+#include <qstandardpaths.h>
 #include <qscrollarea.h>
 #include <qstackedwidget.h>
-#include <qsvggenerator.h>
+#include <qstatusbar.h>
+#include <qtconcurrentrun.h>
 #include <qtoolbar.h>
 
 #include <spdlog/spdlog.h>
 
 namespace sketchy::ui {
+namespace {
+/// Saving to a file with this suffix writes a tiled notebook, which is paged
+/// in and out as the view moves
+constexpr auto notebook_suffix = ".sknb";
+
+/// Where settings live, set explicitly since the app does not name itself
+constexpr auto settings_org = "sketchy";
+constexpr auto settings_app = "sketchy";
+constexpr auto predict_key = "ink/predict";
+/// Sidecar logs which are open, so that any left behind by a crash can be
+/// found at startup
+constexpr auto logs_key = "recovery/logs";
+
+auto open_logs() -> QStringList
+{
+    return QSettings{settings_org, settings_app}.value(logs_key).toStringList();
+}
+void set_open_logs(const QStringList& logs)
+{
+    QSettings{settings_org, settings_app}.setValue(logs_key, logs);
+}
+
+/// Log for a document which has never been saved
+auto untitled_wal() -> QString
+{
+    const auto dir =
+        QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir{}.mkpath(dir);
+    return dir + "/untitled.wal";
+}
+} // namespace
+
 main_window::main_window(logger_t logger)
     : logger_{std::move(logger)},
+      storage_logger_{logging::get(logging::storage)},
       center_container_{new QStackedWidget},
-      canvas_{new canvas{logger_->clone("canvas")}}
+      canvas_{new canvas{logging::get(logging::canvas)}}
 {
     auto* w = new QWidget;
     auto* layout = new QHBoxLayout{w};
@@ -50,10 +94,50 @@ main_window::main_window(logger_t logger)
     const auto aval = QApplication::primaryScreen()->availableSize();
     setMinimumSize(aval.width() / 3 * 2, aval.height() / 3 * 2);
 
+    if (const auto budget =
+            qEnvironmentVariableIntValue("SKETCHY_MEMORY_BUDGET_MB");
+        budget > 0) {
+        canvas_->memory_budget(static_cast<std::size_t>(budget) * 1024 *
+                               1024);
+    }
+
+    if (auto ok = false; qEnvironmentVariableIsSet("SKETCHY_SIMPLIFY_PX")) {
+        const auto px =
+            qEnvironmentVariable("SKETCHY_SIMPLIFY_PX").toDouble(&ok);
+        if (ok && px >= 0) {
+            canvas_->simplify_tolerance(px);
+        }
+    }
+
     center_container_->addWidget(canvas_);
     center_container_->setCurrentWidget(canvas_);
     connect(canvas_, &canvas::content_menu_wanted, this,
             &main_window::on_radial_menu_wanted);
+    connect(canvas_, &canvas::changed, this, [this](const changeset& c) {
+        if (!wal_) {
+            return;
+        }
+        wal_->append(c);
+        if (const auto e = wal_->take_error(); !e.empty()) {
+            storage_logger_->error("autosave stopped: {}", e);
+            statusBar()->showMessage(tr("Autosave stopped: %1")
+                                         .arg(QString::fromStdString(e)));
+        }
+    });
+    connect(&save_watcher_, &QFutureWatcher<QString>::progressValueChanged,
+            this, &main_window::on_save_progress);
+    connect(&save_watcher_, &QFutureWatcher<QString>::finished, this,
+            &main_window::on_save_finished);
+    connect(&export_watcher_, &QFutureWatcher<QString>::progressValueChanged,
+            this, [this](int percent) {
+                statusBar()->showMessage(tr("Exporting... %1%").arg(percent));
+            });
+    connect(&export_watcher_, &QFutureWatcher<QString>::finished, this,
+            &main_window::on_export_finished);
+    connect(&load_watcher_, &QFutureWatcher<load_batch>::resultsReadyAt, this,
+            &main_window::on_load_batches);
+    connect(&load_watcher_, &QFutureWatcher<load_batch>::finished, this,
+            &main_window::on_load_finished);
 
     auto* tbar = addToolBar(tr("tools"));
 
@@ -77,6 +161,28 @@ main_window::main_window(logger_t logger)
     tools_acts_.emplace_back(draw_act);
     tools_acts_.emplace_back(erase_act);
 
+    auto* split_act = new QAction{tr("Cut Strokes"), this};
+    split_act->setCheckable(true);
+    split_act->setChecked(true);
+    split_act->setToolTip(tr("Erase only the part of a stroke under the "
+                             "eraser rather than the whole stroke"));
+    connect(split_act, &QAction::toggled, canvas_, &canvas::split_on_erase);
+    tbar->addSeparator();
+    tbar->addAction(split_act);
+
+    auto* predict_act = new QAction{tr("Predict Ink"), this};
+    predict_act->setCheckable(true);
+    predict_act->setToolTip(tr("Draw where the pen is heading so ink keeps "
+                               "up with it, corrected as the pen moves"));
+    connect(predict_act, &QAction::toggled, this, [this](bool on) {
+        canvas_->predict_ink(on);
+        QSettings{settings_org, settings_app}.setValue(predict_key, on);
+    });
+    predict_act->setChecked(
+        QSettings{settings_org, settings_app}.value(predict_key, false)
+            .toBool());
+    tbar->addAction(predict_act);
+
     auto* save_act = new QAction{tr("Save"), this};
     save_act->setShortcut(QKeySequence::Save);
     connect(save_act, &QAction::triggered, this, &main_window::on_save);
@@ -96,6 +202,14 @@ main_window::main_window(logger_t logger)
     connect(export_act, &QAction::triggered, this,
             &main_window::on_export_all_svg);
 
+    auto* export_json_act = new QAction{tr("Export JSON..."), this};
+    connect(export_json_act, &QAction::triggered, this,
+            &main_window::on_export_json);
+
+    auto* export_png_act = new QAction{tr("Export PNG..."), this};
+    connect(export_png_act, &QAction::triggered, this,
+            &main_window::on_export_png);
+
     auto* mfile = menuBar()->addMenu("&File");
     mfile->addAction(save_act);
     mfile->addAction(save_as_act);
@@ -103,21 +217,92 @@ main_window::main_window(logger_t logger)
     mfile->addAction(load_act);
     mfile->addSeparator();
     mfile->addAction(export_act);
+    mfile->addAction(export_json_act);
+    mfile->addAction(export_png_act);
+
+    auto* zoom_in_act = new QAction{tr("Zoom In"), this};
+    zoom_in_act->setShortcut(QKeySequence::ZoomIn);
+    connect(zoom_in_act, &QAction::triggered, this,
+            [this] { canvas_->zoom_by(2); });
+    auto* zoom_out_act = new QAction{tr("Zoom Out"), this};
+    zoom_out_act->setShortcut(QKeySequence::ZoomOut);
+    connect(zoom_out_act, &QAction::triggered, this,
+            [this] { canvas_->zoom_by(0.5); });
+    auto* zoom_reset_act = new QAction{tr("Actual Size"), this};
+    zoom_reset_act->setShortcut(QKeySequence::fromString("Ctrl+0"));
+    connect(zoom_reset_act, &QAction::triggered, canvas_,
+            &canvas::reset_zoom);
+
+    auto* mview = menuBar()->addMenu("&View");
+    mview->addAction(zoom_in_act);
+    mview->addAction(zoom_out_act);
+    mview->addAction(zoom_reset_act);
+
+    auto* stats_act = new QAction{tr("Memory Stats"), this};
+    stats_act->setCheckable(true);
+    stats_act->setShortcut(QKeySequence::fromString("Ctrl+Shift+M"));
+    stats_timer_.setInterval(1000);
+    connect(&stats_timer_, &QTimer::timeout, this,
+            &main_window::on_stats_tick);
+    connect(stats_act, &QAction::toggled, this, [this](bool on) {
+        show_memory_ = on;
+        on_stats_tick();
+    });
+    auto* hud_act = new QAction{tr("Latency HUD"), this};
+    hud_act->setCheckable(true);
+    hud_act->setShortcut(QKeySequence::fromString("Ctrl+Shift+L"));
+    hud_act->setToolTip(tr("Paint, input, erase and save times since "
+                           "startup, with how late input arrives"));
+    connect(hud_act, &QAction::toggled, this, [this](bool on) {
+        show_latency_ = on;
+        on_stats_tick();
+    });
+    mview->addSeparator();
+    mview->addAction(stats_act);
+    mview->addAction(hud_act);
+
+    try {
+        if (const auto w = wal::read(untitled_wal())) {
+            recover(*w);
+        }
+    }
+    catch (const std::exception& e) {
+        storage_logger_->error("failed to recover unsaved work: {}",
+                               e.what());
+    }
+    start_wal({});
+    // Once the window is up, so the question has something to sit over
+    QTimer::singleShot(0, this, &main_window::offer_recovery);
+}
+
+main_window::~main_window()
+{
+    load_watcher_.cancel();
+    load_watcher_.waitForFinished();
+    export_watcher_.waitForFinished();
+    // Let a save in flight finish rather than lose it
+    save_watcher_.waitForFinished();
+    // A clean exit, so the log goes with it
+    close_wal();
 }
 
 void on_radial_menu_wanted(const QPointF&) {}
 void main_window::export_all_svg_to(const QString& path) const
 {
-    QSvgGenerator gen;
-    gen.setFileName(path);
-    gen.setSize(canvas_->scene_size().toSize());
-    QFile out{path};
-    out.open(QFile::WriteOnly);
-    gen.setOutputDevice(&out);
-
-    QPainter p{&gen};
-    canvas_->print_area(p, QRectF{QPointF{0, 0}, canvas_->scene_size()});
-    p.end();
+    QSaveFile out{path};
+    try {
+        if (!out.open(QFile::WriteOnly)) {
+            throw io_error{"failed to open"};
+        }
+        write_svg(out, canvas_->snapshot());
+        if (!out.commit()) {
+            throw io_error{"failed to write"};
+        }
+    }
+    catch (const std::exception& e) {
+        storage_logger_->error("failed to export {}: {}", path.toStdString(),
+                               e.what());
+    }
 }
 
 void main_window::on_export_all_svg()
@@ -131,36 +316,445 @@ void main_window::on_export_all_svg()
 }
 void main_window::on_save_as(const QString& p)
 {
+    if (save_watcher_.isRunning() || !loading_path_.isEmpty()) {
+        // The document stays where it is until this save actually starts
+        save_as_ = p;
+        save_again_ = true;
+        return;
+    }
     save_path_ = p;
+    if (p.endsWith(notebook_suffix)) {
+        begin_notebook_save(p);
+        return;
+    }
+    journal_ = std::make_shared<journal>(p);
+    begin_save(journal_, true);
+}
+void main_window::begin_save(std::shared_ptr<journal> j, bool full)
+{
+    run_save(full, [j = std::move(j), doc = canvas_->deferred_snapshot(),
+                    full](QPromise<QString>& promise,
+                          const changeset& changes) mutable {
+        const auto compact = [&](int from) {
+            j->compact(doc(), [&promise, from](int percent) {
+                promise.setProgressValue(from + percent * (100 - from) / 100);
+            });
+        };
+        if (full) {
+            compact(0);
+        }
+        else {
+            j->append(changes);
+            promise.setProgressValue(50);
+            if (j->needs_compaction()) {
+                compact(50);
+            }
+        }
+    });
+}
+void main_window::begin_tile_save()
+{
+    saving_tiles_ =
+        std::make_shared<const tile_writes>(canvas_->begin_tile_writes());
+    run_save(false, [w = saving_tiles_](QPromise<QString>&,
+                                        const changeset&) { w->write(); });
+}
+void main_window::begin_notebook_save(const QString& path)
+{
+    saving_notebook_ = path;
+    run_save(true, [path, doc = canvas_->deferred_snapshot()](
+                       QPromise<QString>&, const changeset&) mutable {
+        tile_store::create(path, doc().stored());
+    });
+}
+void main_window::run_save(
+    bool full, std::function<void(QPromise<QString>&, const changeset&)> write)
+{
+    // Marked saved up front so anything erased while the save runs is
+    // recorded against the saved document
+    saving_ = canvas_->unsaved_changes();
+    saving_full_ = full;
+    saving_epoch_ = doc_epoch_;
+    canvas_->mark_saved(saving_);
+
+    auto job = [write = std::move(write),
+                changes = saving_](QPromise<QString>& promise) {
+        const metrics::scoped_timer timer{metrics::timing::save};
+        promise.setProgressRange(0, 100);
+        try {
+            write(promise, changes);
+            promise.addResult(QString{});
+        }
+        catch (const std::exception& e) {
+            promise.addResult(QString::fromUtf8(e.what()));
+        }
+    };
+    statusBar()->showMessage(tr("Saving %1...").arg(save_path_));
+    save_watcher_.setFuture(QtConcurrent::run(std::move(job)));
+}
+void main_window::start_wal(const QString& base)
+{
+    // Closing the old log removes its file, which may be where the new one
+    // goes
+    close_wal();
+    const auto path = base.isEmpty() ? untitled_wal() : wal::sidecar(base);
+    if (auto logs = open_logs(); !base.isEmpty() && !logs.contains(path)) {
+        logs.append(path);
+        set_open_logs(logs);
+    }
+    // Whatever is unsaved now is not in base, so it goes first
+    wal_ = std::make_unique<wal>(path, base, canvas_->unsaved_changes());
+}
+void main_window::close_wal()
+{
+    if (!wal_) {
+        return;
+    }
+    const auto path = wal_->path();
+    wal_.reset();
+    auto logs = open_logs();
+    // Left listed if it could not be removed, so it is still found
+    if (!QFile::exists(path) && logs.removeAll(path) > 0) {
+        set_open_logs(logs);
+    }
+}
+void main_window::offer_recovery()
+{
+    auto logs = open_logs();
+    // Recovered and removed when their document was opened
+    const auto gone =
+        logs.removeIf([](const QString& p) { return !QFile::exists(p); });
+    if (gone > 0) {
+        set_open_logs(logs);
+    }
+    for (const auto& path : logs) {
+        std::optional<wal::contents> w;
+        try {
+            w = wal::read(path);
+        }
+        catch (const std::exception& e) {
+            storage_logger_->error("failed to read {}: {}", path.toStdString(),
+                                   e.what());
+        }
+        if (!w || w->base.isEmpty() || w->changes.empty()) {
+            continue;
+        }
+        if (canvas_->has_unsaved_changes()) {
+            // Opening it would throw away what was recovered already
+            storage_logger_->info("unsaved changes to {} are recovered when "
+                                  "it is opened",
+                                  w->base.toStdString());
+            continue;
+        }
+        const auto answer = QMessageBox::question(
+            this, tr("Recover unsaved work"),
+            tr("%1 was not closed cleanly and has unsaved changes. Open it "
+               "to recover them?")
+                .arg(w->base));
+        if (answer == QMessageBox::Yes) {
+            // Replays the log once the document is in
+            on_load_from(w->base);
+            return;
+        }
+    }
+}
+void main_window::recover(const wal::contents& w)
+{
+    for (const auto& c : w.changes) {
+        canvas_->apply(c);
+    }
+    storage_logger_->info("recovered {} changes to {}", w.changes.size(),
+                          w.base.isEmpty() ? "an unsaved document"
+                                           : w.base.toStdString());
+    statusBar()->showMessage(tr("Recovered unsaved changes"), 5000);
+}
+void main_window::on_save_progress(int percent)
+{
+    statusBar()->showMessage(
+        tr("Saving %1... %2%").arg(save_path_).arg(percent));
+}
+void main_window::on_save_finished()
+{
+    const auto error = save_watcher_.future().resultCount() > 0
+                           ? save_watcher_.result()
+                           : tr("save was cancelled");
+    const auto same_doc = saving_epoch_ == doc_epoch_;
+    const auto tiles = std::exchange(saving_tiles_, nullptr);
+    const auto notebook = std::exchange(saving_notebook_, {});
+    if (tiles) {
+        canvas_->end_tile_writes(*tiles, error.isEmpty());
+    }
+    if (error.isEmpty()) {
+        SKETCHY_DEBUG(storage_logger_, "saved {} added, {} erased",
+                      saving_.added.size(), saving_.erased.size());
+        statusBar()->showMessage(tr("Saved %1").arg(save_path_), 3000);
+        if (same_doc && !notebook.isEmpty()) {
+            try {
+                // Anything drawn while it was written is not in it
+                const auto since = canvas_->unsaved_changes();
+                canvas_->open_store(std::make_shared<tile_store>(notebook));
+                canvas_->apply(since);
+                journal_.reset();
+                start_wal(notebook);
+            }
+            catch (const std::exception& e) {
+                storage_logger_->error("failed to open {}: {}",
+                                       notebook.toStdString(), e.what());
+            }
+        }
+        else if (same_doc) {
+            // Everything logged so far is on disk now
+            start_wal(tiles ? save_path_ : journal_->path());
+        }
+    }
+    else {
+        storage_logger_->error("failed to save {}: {}",
+                               save_path_.toStdString(),
+                               error.toStdString());
+        statusBar()->showMessage(tr("Failed to save: %1").arg(error));
+        if (same_doc) {
+            canvas_->mark_unsaved(saving_);
+            if (saving_full_ && notebook.isEmpty()) {
+                journal_.reset();
+            }
+        }
+    }
+    saving_ = {};
+    if (std::exchange(save_again_, false) && same_doc) {
+        on_save();
+    }
+}
+void main_window::export_json_to(const QString& p) const
+{
     const auto json = to_json(canvas_->strokes());
-    spdlog::debug("saving document as: {}", json);
-    QFile f{p};
-    f.open(QFile::WriteOnly);
-    f.write(json.c_str(), json.size());
+    QSaveFile out{p};
+    try {
+        if (!out.open(QFile::WriteOnly)) {
+            throw io_error{"failed to open"};
+        }
+        if (out.write(json.c_str(), static_cast<qint64>(json.size())) !=
+                static_cast<qint64>(json.size()) ||
+            !out.commit()) {
+            throw io_error{"failed to write"};
+        }
+        statusBar()->showMessage(tr("Exported %1").arg(p), 3000);
+    }
+    catch (const std::exception& e) {
+        storage_logger_->error("failed to export {}: {}", p.toStdString(),
+                               e.what());
+        statusBar()->showMessage(
+            tr("Failed to export: %1").arg(QString::fromUtf8(e.what())));
+    }
+}
+void main_window::on_export_png()
+{
+    if (export_watcher_.isRunning()) {
+        return;
+    }
+    auto* dialog = new QFileDialog{this};
+    dialog->setAcceptMode(QFileDialog::AcceptSave);
+    dialog->setFileMode(QFileDialog::FileMode::AnyFile);
+    dialog->setNameFilter(tr("PNG images (*.png)"));
+    connect(dialog, &QFileDialog::fileSelected, this,
+            &main_window::export_png_to);
+    dialog->open();
+}
+void main_window::export_png_to(const QString& path)
+{
+    auto ok = false;
+    const auto dpi = QInputDialog::getInt(this, tr("Export PNG"),
+                                          tr("Resolution (DPI)"), 300, 24,
+                                          2400, 1, &ok);
+    if (!ok) {
+        return;
+    }
+    auto job = [path, doc = canvas_->snapshot(),
+                dpi](QPromise<QString>& promise) {
+        promise.setProgressRange(0, 100);
+        try {
+            QSaveFile out{path};
+            if (!out.open(QFile::WriteOnly)) {
+                throw io_error{"failed to open"};
+            }
+            raster_options opts;
+            opts.dpi = dpi;
+            export_png(out, doc, opts, [&promise](int percent) {
+                promise.setProgressValue(percent);
+            });
+            if (!out.commit()) {
+                throw io_error{"failed to write"};
+            }
+            promise.addResult(QString{});
+        }
+        catch (const std::exception& e) {
+            promise.addResult(QString::fromUtf8(e.what()));
+        }
+    };
+    exporting_path_ = path;
+    statusBar()->showMessage(tr("Exporting %1...").arg(path));
+    export_watcher_.setFuture(QtConcurrent::run(std::move(job)));
+}
+void main_window::on_export_finished()
+{
+    const auto error = export_watcher_.result();
+    if (error.isEmpty()) {
+        statusBar()->showMessage(tr("Exported %1").arg(exporting_path_),
+                                 3000);
+    }
+    else {
+        storage_logger_->error("failed to export {}: {}",
+                               exporting_path_.toStdString(),
+                               error.toStdString());
+        statusBar()->showMessage(tr("Failed to export: %1").arg(error));
+    }
+}
+void main_window::on_export_json()
+{
+    auto* dialog = new QFileDialog{this};
+    dialog->setAcceptMode(QFileDialog::AcceptSave);
+    dialog->setFileMode(QFileDialog::FileMode::AnyFile);
+    connect(dialog, &QFileDialog::fileSelected, this,
+            &main_window::export_json_to);
+    dialog->open();
 }
 void main_window::on_save_as_clicked()
 {
     auto* dialog = new QFileDialog{this};
     dialog->setAcceptMode(QFileDialog::AcceptSave);
     dialog->setFileMode(QFileDialog::FileMode::AnyFile);
+    dialog->setNameFilters({tr("Sketchy documents (*.sketchy)"),
+                            tr("Sketchy notebooks (*%1)").arg(notebook_suffix),
+                            tr("All files (*)")});
     connect(dialog, &QFileDialog::fileSelected, this, &main_window::on_save_as);
     dialog->open();
 }
 void main_window::on_save()
 {
-    if (save_path_.isEmpty()) {
+    if (!loading_path_.isEmpty()) {
+        // Saving half a document would lose the rest
+        save_again_ = true;
+    }
+    else if (save_watcher_.isRunning()) {
+        // Picks up whatever changed since the save in flight started
+        save_again_ = true;
+    }
+    else if (!save_as_.isEmpty()) {
+        on_save_as(std::exchange(save_as_, {}));
+    }
+    else if (save_path_.isEmpty()) {
         on_save_as_clicked();
     }
-    else {
+    else if (canvas_->has_store()) {
+        begin_tile_save();
+    }
+    else if (!journal_ || journal_->path() != save_path_) {
         on_save_as(save_path_);
     }
+    else if (canvas_->has_unsaved_changes()) {
+        begin_save(journal_, false);
+    }
 }
 void main_window::on_load_from(const QString& p)
 {
+    // The save could be writing the file about to be read
+    save_watcher_.waitForFinished();
+    save_again_ = false;
+    save_as_.clear();
+    ++doc_epoch_;
+    if (load_watcher_.isRunning()) {
+        load_watcher_.cancel();
+    }
+
     QFile f{p};
-    f.open(QFile::ReadOnly);
-    canvas_->set_strokes(from_json(f.readAll().toStdString()));
-    save_path_ = p;
+    if (!f.open(QFile::ReadOnly)) {
+        storage_logger_->error("failed to open: {}", p.toStdString());
+        return;
+    }
+    const auto header = f.read(64);
+    f.close();
+    journal_.reset();
+    save_path_.clear();
+    // Unsaved work on the canvas is thrown away along with it
+    close_wal();
+    recovering_.reset();
+    if (tile_store::is_tile_store({header.constData(),
+                                   static_cast<std::size_t>(header.size())})) {
+        try {
+            // Already paged in lazily around the view
+            canvas_->open_store(std::make_shared<tile_store>(p));
+            save_path_ = p;
+        }
+        catch (const std::exception& e) {
+            storage_logger_->error("failed to load {}: {}", p.toStdString(),
+                                   e.what());
+            return;
+        }
+        try {
+            if (const auto w = wal::read(wal::sidecar(p))) {
+                recover(*w);
+            }
+        }
+        catch (const std::exception& e) {
+            storage_logger_->error("failed to recover unsaved work on {}: {}",
+                                   p.toStdString(), e.what());
+        }
+        start_wal(p);
+        return;
+    }
+    try {
+        recovering_ = wal::read(wal::sidecar(p));
+    }
+    catch (const std::exception& e) {
+        storage_logger_->error("failed to recover unsaved work on {}: {}",
+                               p.toStdString(), e.what());
+    }
+    canvas_->begin_load();
+    loading_path_ = p;
+    statusBar()->showMessage(tr("Loading %1...").arg(p));
+    load_watcher_.setFuture(load_document(p, canvas_->visible_area()));
+}
+void main_window::on_load_batches(int begin, int end)
+{
+    for (auto i = begin; i != end; ++i) {
+        const auto batch = load_watcher_.resultAt(i);
+        if (!batch.error.isEmpty()) {
+            storage_logger_->error("failed to load {}: {}",
+                                   loading_path_.toStdString(),
+                                   batch.error.toStdString());
+            statusBar()->showMessage(
+                tr("Failed to load: %1").arg(batch.error));
+            canvas_->set_strokes(std::vector<stored_stroke>{});
+            loading_path_.clear();
+            // Left where it is for when the document can be read
+            recovering_.reset();
+            start_wal({});
+            return;
+        }
+        if (batch.source) {
+            journal_ = batch.source;
+        }
+        canvas_->add_loaded(batch.strokes, batch.next_id);
+    }
+}
+void main_window::on_load_finished()
+{
+    if (load_watcher_.isCanceled() || loading_path_.isEmpty()) {
+        return;
+    }
+    canvas_->end_load();
+    statusBar()->showMessage(tr("Loaded %1").arg(loading_path_), 3000);
+    if (save_path_.isEmpty()) {
+        save_path_ = loading_path_;
+    }
+    if (recovering_) {
+        recover(*recovering_);
+        recovering_.reset();
+    }
+    start_wal(loading_path_);
+    loading_path_.clear();
+    if (std::exchange(save_again_, false)) {
+        on_save();
+    }
 }
 void main_window::on_load_from_clicked()
 {
@@ -173,22 +767,40 @@ void main_window::on_load_from_clicked()
 
 void main_window::switch_to_draw_mode()
 {
-    logger_->debug("switch mode: draw");
+    SKETCHY_DEBUG(logger_, "switch mode: draw");
     canvas_->curr_mode(canvas::mode::draw);
 }
 void main_window::switch_to_move_mode()
 {
-    logger_->debug("switch mode: move");
+    SKETCHY_DEBUG(logger_, "switch mode: move");
     canvas_->curr_mode(canvas::mode::move);
 }
 void main_window::switch_to_erase_mode()
 {
-    logger_->debug("switch mode: erase");
+    SKETCHY_DEBUG(logger_, "switch mode: erase");
     canvas_->curr_mode(canvas::mode::erase);
 }
+void main_window::on_stats_tick()
+{
+    std::string text;
+    if (show_memory_) {
+        text = to_text(canvas_->memory());
+    }
+    if (show_latency_) {
+        text += (text.empty() ? "" : "\n\n") + metrics::summary();
+    }
+    canvas_->debug_overlay(QString::fromStdString(text));
+    if (text.empty()) {
+        stats_timer_.stop();
+    }
+    else if (!stats_timer_.isActive()) {
+        stats_timer_.start();
+    }
+}
+
 void main_window::on_radial_menu_wanted(const QPointF& at)
 {
-    logger_->debug("radial menu requested");
+    SKETCHY_DEBUG(logger_, "radial menu requested");
     if (!tools_menu_) {
         tools_menu_ = new radial_menu;
         std::for_each(tools_acts_.begin(), tools_acts_.end(),
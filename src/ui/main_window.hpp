@@ -17,20 +17,33 @@
 
 #pragma once
 
+#include <qfuturewatcher.h>
 #include <qmainwindow.h>
+#include <qpromise.h>
+#include <qtimer.h>
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+
+#include "journal.hpp"
 #include "logger.hpp"
+#include "ui/loader.hpp"
+#include "wal.hpp"
 
 class QStackedWidget;
 
 namespace sketchy::ui {
 class canvas;
 class radial_menu;
+struct tile_writes;
 
 class main_window : public QMainWindow {
     Q_OBJECT
 public:
     explicit main_window(logger_t logger);
+    ~main_window() override;
 
 private slots:
     void switch_to_draw_mode();
@@ -43,18 +56,81 @@ private slots:
     void on_load_from_clicked();
     void on_export_all_svg();
     void export_all_svg_to(const QString&) const;
+    void on_export_json();
+    void export_json_to(const QString&) const;
+    void on_export_png();
+    void export_png_to(const QString&);
+    void on_export_finished();
     void on_radial_menu_wanted(const QPointF&);
+    void on_save_progress(int percent);
+    void on_save_finished();
+    void on_load_batches(int begin, int end);
+    void on_load_finished();
+    void on_stats_tick();
 
 private:
+    /// Write the journal on a worker thread, either appending what changed
+    /// or, with full, replacing it with the whole document
+    void begin_save(std::shared_ptr<journal> j, bool full);
+    /// Write the modified notebook tiles back on a worker thread
+    void begin_tile_save();
+    /// Write the whole document out as a new notebook at path on a worker
+    /// thread, and page from it once it is done
+    void begin_notebook_save(const QString& path);
+    /// Mark everything unsaved as saved and call write with it on a worker
+    /// thread. on_save_finished() undoes the marking if write throws
+    void run_save(
+        bool full,
+        std::function<void(QPromise<QString>&, const changeset&)> write);
+    /// Log changes from here on over base, the document on disk or empty
+    /// for one which has never been saved
+    void start_wal(const QString& base);
+    /// Close the log cleanly, which removes it
+    void close_wal();
+    /// Ask whether to open a document whose log was left behind by a crash
+    void offer_recovery();
+    /// Replay a log left behind by a crash onto the canvas
+    void recover(const wal::contents& w);
+
     auto make_action(const QString& txt, const std::function<void()>& act)
         -> QAction*;
 
     logger_t logger_;
+    logger_t storage_logger_;
     QStackedWidget* center_container_;
     canvas* canvas_;
     radial_menu* tools_menu_{nullptr};
     QString save_path_;
+    /// Shared with the save in flight, if there is one
+    std::shared_ptr<journal> journal_;
+    /// Result of the save in flight, empty on success or else the error
+    QFutureWatcher<QString> save_watcher_;
+    changeset saving_;
+    bool saving_full_{false};
+    std::uint64_t saving_epoch_{0};
+    /// Tiles being written back by the save in flight
+    std::shared_ptr<const tile_writes> saving_tiles_;
+    /// Notebook being written by the save in flight
+    QString saving_notebook_;
+    /// Save was asked for while one was in flight
+    bool save_again_{false};
+    /// Where that save goes, if it was a save as
+    QString save_as_;
+    QFutureWatcher<load_batch> load_watcher_;
+    QFutureWatcher<QString> export_watcher_;
+    QString exporting_path_;
+    /// Document still streaming in, empty once it has all arrived
+    QString loading_path_;
+    /// Bumped whenever another document is loaded
+    std::uint64_t doc_epoch_{0};
     std::vector<QAction*> tools_acts_;
+    std::unique_ptr<wal> wal_;
+    /// Log left behind for the document being loaded
+    std::optional<wal::contents> recovering_;
+    /// Refreshes the debug overlay while it is shown
+    QTimer stats_timer_;
+    bool show_memory_{false};
+    bool show_latency_{false};
 };
 
 } // namespace sketchy::ui
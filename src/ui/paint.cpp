@@ -0,0 +1,87 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "paint.hpp"
+
+#include "outline.hpp"
+
+#include <qbrush.h>
+#include <qpainter.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+auto pixel_key(double x) -> std::uint64_t
+{
+    return static_cast<std::uint32_t>(static_cast<std::int32_t>(std::floor(x)));
+}
+} // namespace
+
+namespace sketchy::ui {
+
+outline_painter::outline_painter(QPainter& p) : p_{&p}
+{
+    p.setPen(Qt::NoPen);
+    p.setBrush(colour_);
+}
+
+void outline_painter::paint(const QPolygonF& outline, const QColor& colour)
+{
+    if (outline.empty()) {
+        return;
+    }
+    use(colour);
+    p_->drawPolygon(outline, Qt::WindingFill);
+    dots_.clear();
+}
+
+void outline_painter::paint_dot(const QRectF& bounds, const QColor& colour)
+{
+    const auto& t = p_->worldTransform();
+    const auto at = t.map(bounds.center());
+    const auto key = pixel_key(at.x()) << 32 | pixel_key(at.y());
+    const auto rgb = colour.rgba();
+    if (auto [it, added] = dots_.try_emplace(key, rgb); !added) {
+        if (it->second == rgb) {
+            return;
+        }
+        it->second = rgb;
+    }
+    use(colour);
+    const auto px = 1 / t.m11();
+    const auto w = std::max(bounds.width(), px);
+    const auto h = std::max(bounds.height(), px);
+    p_->drawRect(QRectF{bounds.center() - QPointF{w / 2, h / 2}, QSizeF{w, h}});
+}
+
+void outline_painter::use(const QColor& colour)
+{
+    if (colour != colour_) {
+        colour_ = colour;
+        p_->setBrush(colour_);
+    }
+}
+
+void outline_painter::paint(const stroke_view& s)
+{
+    stroke_outline(s, scratch_);
+    paint(scratch_, s.colour);
+}
+
+} // namespace sketchy::ui
@@ -0,0 +1,60 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "document.hpp"
+
+#include <qcolor.h>
+#include <qpolygon.h>
+
+#include <cstdint>
+#include <unordered_map>
+
+class QPainter;
+
+namespace sketchy::ui {
+
+/// Fills stroke outlines with one drawPolygon() each. The pen is turned off
+/// and the brush only changes when the colour does. A stroke is a single
+/// fill, so translucent ones do not darken where they cross themselves.
+/// Changes the state of p, which must outlive this
+class outline_painter {
+public:
+    explicit outline_painter(QPainter& p);
+
+    /// outline is from outline_builder or stroke_outline()
+    void paint(const QPolygonF& outline, const QColor& colour);
+    /// Works out the outline of s first
+    void paint(const stroke_view& s);
+    /// A stroke too small to make out, as its bounds grown to a device
+    /// pixel. Dots the same colour as the last dot on their pixel are
+    /// skipped, so a dense area zoomed out costs what its pixels do
+    void paint_dot(const QRectF& bounds, const QColor& colour);
+
+private:
+    void use(const QColor& colour);
+
+    QPainter* p_;
+    QColor colour_;
+    QPolygonF scratch_;
+    /// Colour of the last dot on each device pixel since an outline was
+    /// painted, which may have covered them
+    std::unordered_map<std::uint64_t, QRgb> dots_;
+};
+
+} // namespace sketchy::ui
@@ -0,0 +1,119 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "raster_export.hpp"
+#include "png_writer.hpp"
+#include "ui/paint.hpp"
+
+#include <qimage.h>
+#include <qpainter.h>
+#include <qthread.h>
+#include <qtconcurrentmap.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace sketchy::ui {
+namespace {
+/// Resolution scene units are drawn at when not scaled
+constexpr double scene_dpi = 96;
+
+struct tile {
+    int top;
+    int height;
+    /// Indices into the document, in stacking order
+    std::vector<std::size_t> strokes;
+    QImage image;
+};
+} // namespace
+
+void export_png(QIODevice& out, const document& doc,
+                const raster_options& opts,
+                const std::function<void(int)>& progress)
+{
+    const auto scale = opts.dpi / scene_dpi;
+    const auto ink = doc.bounds().adjusted(-opts.margin, -opts.margin,
+                                           opts.margin, opts.margin);
+    const auto width = std::max(1, static_cast<int>(std::ceil(ink.width() *
+                                                              scale)));
+    const auto height = std::max(
+        1, static_cast<int>(std::ceil(ink.height() * scale)));
+
+    const auto tile_height = static_cast<int>(std::clamp<std::size_t>(
+        opts.tile_bytes / (static_cast<std::size_t>(width) * 4), 1,
+        static_cast<std::size_t>(height)));
+    std::vector<tile> tiles;
+    for (auto top = 0; top < height; top += tile_height) {
+        tiles.push_back({top, std::min(tile_height, height - top), {}, {}});
+    }
+    for (auto& t : tiles) {
+        // A pixel either side covers anything rounded into the strip
+        const auto top = ink.top() + (t.top - 1) / scale;
+        const auto bottom = ink.top() + (t.top + t.height + 1) / scale;
+        doc.query(QRectF{QPointF{ink.left(), top},
+                         QPointF{ink.right(), bottom}},
+                  t.strokes);
+    }
+
+    const auto render = [&](tile& t) {
+        t.image = QImage{width, t.height, QImage::Format_RGB32};
+        t.image.fill(opts.background);
+        QPainter p{&t.image};
+        p.setRenderHint(QPainter::Antialiasing);
+        p.setTransform(QTransform{scale, 0, 0, scale, -ink.left() * scale,
+                                  -ink.top() * scale - t.top});
+        outline_painter painter{p};
+        for (const auto i : t.strokes) {
+            painter.paint(doc.view(i));
+        }
+    };
+
+    png_writer png{out, static_cast<std::uint32_t>(width),
+                   static_cast<std::uint32_t>(height), opts.dpi};
+    std::vector<std::uint8_t> row(static_cast<std::size_t>(width) * 3);
+    const auto threads =
+        static_cast<std::ptrdiff_t>(std::max(1, QThread::idealThreadCount()));
+    for (auto first = tiles.begin(); first != tiles.end();) {
+        const auto last =
+            first + std::min(threads, std::distance(first, tiles.end()));
+        QtConcurrent::blockingMap(first, last, render);
+        for (auto it = first; it != last; ++it) {
+            for (auto y = 0; y != it->height; ++y) {
+                const auto* px =
+                    reinterpret_cast<const QRgb*>(it->image.constScanLine(y));
+                for (std::size_t x = 0; x != row.size() / 3; ++x) {
+                    row[x * 3] = static_cast<std::uint8_t>(qRed(px[x]));
+                    row[x * 3 + 1] = static_cast<std::uint8_t>(qGreen(px[x]));
+                    row[x * 3 + 2] = static_cast<std::uint8_t>(qBlue(px[x]));
+                }
+                png.write_row(row.data());
+            }
+            it->image = {};
+            it->strokes = {};
+        }
+        first = last;
+        if (progress) {
+            progress(static_cast<int>(std::distance(tiles.begin(), first) *
+                                      100 / std::ssize(tiles)));
+        }
+    }
+    png.finish();
+}
+
+} // namespace sketchy::ui
@@ -0,0 +1,49 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "document.hpp"
+
+#include <qcolor.h>
+
+#include <cstddef>
+#include <functional>
+
+class QIODevice;
+
+namespace sketchy::ui {
+
+struct raster_options {
+    /// Scene units are taken as pixels at 96 DPI, as on screen at 100%
+    double dpi{300};
+    /// Space left around the ink, in scene units
+    double margin{16};
+    /// Size of one tile's image. Tiles are strips the width of the output
+    std::size_t tile_bytes{16 * 1024 * 1024};
+    QColor background{Qt::white};
+};
+
+/// Render doc, cropped to the ink, into a PNG. Tiles are painted in
+/// parallel, each into its own image with its own painter, and streamed
+/// into the PNG in order, so at most one tile per thread is held at once.
+/// progress is called with how far through it is, out of 100
+void export_png(QIODevice& out, const document& doc,
+                const raster_options& opts = {},
+                const std::function<void(int)>& progress = {});
+
+} // namespace sketchy::ui
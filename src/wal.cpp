@@ -0,0 +1,242 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "wal.hpp"
+#include "binary_io.hpp"
+
+#include <qfile.h>
+
+#include <string_view>
+#include <utility>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * File layout, integers little-endian:
+ *
+ *   "SKWAL\0\0\0" u32 version u32 base length
+ *   u8[base length] path of the base document, UTF-8
+ *   record*
+ *
+ * Records are journal changeset records, see journal.cpp
+ */
+
+namespace sketchy {
+namespace {
+constexpr std::string_view wal_magic{"SKWAL\0\0\0", 8};
+constexpr std::uint32_t wal_version = 1;
+constexpr std::size_t wal_header_size = 16;
+
+auto file_header(const QString& base) -> std::string
+{
+    const auto path = base.toUtf8();
+    std::string out{wal_magic};
+    detail::writer w{out};
+    w.write(wal_version);
+    w.write(static_cast<std::uint32_t>(path.size()));
+    out.append(path.constData(), static_cast<std::size_t>(path.size()));
+    return out;
+}
+
+void sync(QFile& f)
+{
+#ifdef _WIN32
+    _commit(f.handle());
+#else
+    ::fsync(f.handle());
+#endif
+}
+} // namespace
+
+wal::wal(QString path, QString base, changeset pending, wal_options opts)
+    : path_{std::move(path)}, base_{std::move(base)}, opts_{opts}
+{
+    writer_ = std::thread{[this, c = std::move(pending)]() mutable {
+        run(std::move(c));
+    }};
+}
+
+wal::~wal()
+{
+    {
+        std::lock_guard lock{mx_};
+        stop_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+    QFile::remove(path_);
+}
+
+void wal::append(changeset c)
+{
+    if (c.empty()) {
+        return;
+    }
+    {
+        std::lock_guard lock{mx_};
+        if (failed_) {
+            return;
+        }
+        queue_.push_back(std::move(c));
+        ++appended_;
+    }
+    wake_.notify_one();
+}
+
+void wal::flush()
+{
+    std::unique_lock lock{mx_};
+    const auto target = appended_;
+    ++flushing_;
+    wake_.notify_one();
+    synced_.wait(lock, [&] { return synced_count_ >= target; });
+    --flushing_;
+}
+
+auto wal::take_error() -> std::string
+{
+    std::lock_guard lock{mx_};
+    return std::exchange(error_, {});
+}
+
+void wal::run(changeset pending)
+{
+    using clock = std::chrono::steady_clock;
+    // Unbuffered so what is written survives the app crashing even before
+    // it is synced
+    QFile f{path_};
+    auto ok = f.open(QFile::WriteOnly | QFile::Truncate | QFile::Unbuffered);
+    std::string buf = file_header(base_);
+    std::vector<changeset> batch;
+    if (!pending.empty()) {
+        batch.push_back(std::move(pending));
+    }
+    std::uint64_t taken = 0;
+    std::size_t unsynced = 0;
+    clock::time_point since;
+
+    std::unique_lock lock{mx_};
+    if (!ok) {
+        failed_ = true;
+        error_ = "failed to open write-ahead log";
+    }
+    for (;;) {
+        // Encode and write what was taken last time round without holding
+        // up append()
+        lock.unlock();
+        for (const auto& c : batch) {
+            buf += detail::changeset_record(c);
+        }
+        batch.clear();
+        auto failed = false;
+        if (ok && !buf.empty()) {
+            if (f.write(buf.data(), static_cast<qint64>(buf.size())) !=
+                static_cast<qint64>(buf.size())) {
+                ok = false;
+                failed = true;
+            }
+            else if (unsynced == 0) {
+                since = clock::now();
+            }
+            unsynced += buf.size();
+        }
+        buf.clear();
+        if (ok && unsynced != 0) {
+            lock.lock();
+            const auto due = stop_ || flushing_ != 0 ||
+                             unsynced >= opts_.sync_bytes ||
+                             clock::now() >= since + opts_.sync_interval;
+            lock.unlock();
+            if (due) {
+                sync(f);
+                unsynced = 0;
+            }
+        }
+        lock.lock();
+        if (failed) {
+            failed_ = true;
+            error_ = "failed to write to write-ahead log";
+            queue_.clear();
+        }
+        if (!ok) {
+            unsynced = 0;
+        }
+        if (unsynced == 0 && synced_count_ != taken) {
+            synced_count_ = taken;
+            synced_.notify_all();
+        }
+        if (stop_ && queue_.empty()) {
+            break;
+        }
+        const auto ready = [this] {
+            return stop_ || !queue_.empty() ||
+                   (flushing_ != 0 && synced_count_ != appended_);
+        };
+        if (unsynced == 0) {
+            wake_.wait(lock, ready);
+        }
+        else {
+            wake_.wait_until(lock, since + opts_.sync_interval, ready);
+        }
+        batch.swap(queue_);
+        taken = appended_;
+    }
+}
+
+auto wal::sidecar(const QString& doc) -> QString
+{
+    return doc + ".wal";
+}
+
+auto wal::read(const QString& path) -> std::optional<contents>
+{
+    QFile f{path};
+    if (!f.open(QFile::ReadOnly)) {
+        return std::nullopt;
+    }
+    const auto bytes = f.readAll();
+    const std::string_view data{bytes.constData(),
+                                static_cast<std::size_t>(bytes.size())};
+    if (data.substr(0, wal_magic.size()) != wal_magic) {
+        throw bad_document{"not a write-ahead log"};
+    }
+    if (data.size() < wal_header_size) {
+        // Torn while being created, so nothing was logged
+        return std::nullopt;
+    }
+    detail::reader r{data.substr(wal_magic.size())};
+    if (r.read<std::uint32_t>() > wal_version) {
+        throw bad_document{"write-ahead log is from a newer version"};
+    }
+    const auto base_size = r.read<std::uint32_t>();
+    if (data.size() - wal_header_size < base_size) {
+        return std::nullopt;
+    }
+    contents out;
+    out.base = QString::fromUtf8(data.data() + wal_header_size,
+                                 static_cast<qsizetype>(base_size));
+    detail::read_changesets(data.substr(wal_header_size + base_size),
+                            out.changes);
+    return out;
+}
+
+} // namespace sketchy
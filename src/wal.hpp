@@ -0,0 +1,106 @@
+// Copyright (C) 2021 Natasha England-Elbro
+//
+// This file is part of sketchy.
+//
+// sketchy is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// sketchy is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with sketchy.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "journal.hpp"
+
+#include <qstring.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sketchy {
+
+/// When a write-ahead log syncs what it has written
+struct wal_options {
+    std::chrono::milliseconds sync_interval{250};
+    std::size_t sync_bytes{256 * 1024};
+};
+
+/// Write-ahead log of what changed since a document was last saved, so a
+/// crash loses at most the last moment of work.
+///
+/// append() only queues the change. A writer thread frames it as a journal
+/// changeset record and writes it out, syncing once sync_interval has passed
+/// since the first unsynced write or sync_bytes have gone out since the last
+/// sync, whichever is first. Closing the log cleanly removes the file, so
+/// finding one means the app did not shut down cleanly
+class wal {
+public:
+    /// What a log left behind says
+    struct contents {
+        /// Document the changes apply over, empty if it was never saved
+        QString base;
+        /// In the order they happened
+        std::vector<changeset> changes;
+    };
+
+    /// Start a log at path, replacing anything there, with pending as its
+    /// first record
+    wal(QString path, QString base, changeset pending = {},
+        wal_options opts = {});
+    /// Writes and syncs what is queued, then removes the file
+    ~wal();
+    wal(const wal&) = delete;
+    auto operator=(const wal&) -> wal& = delete;
+
+    /// Queue c to be written, never waits on the disk
+    void append(changeset c);
+    /// Wait until everything appended so far is synced
+    void flush();
+
+    auto path() const -> const QString& { return path_; }
+    /// Why writing failed, the first time it is asked after a failure and
+    /// empty otherwise. Changes appended after a failure are dropped
+    auto take_error() -> std::string;
+
+    /// Log kept next to the document at doc
+    static auto sidecar(const QString& doc) -> QString;
+    /// Read the log at path up to the first torn record, or nothing if
+    /// there is no log there
+    static auto read(const QString& path) -> std::optional<contents>;
+
+private:
+    void run(changeset pending);
+
+    QString path_;
+    QString base_;
+    wal_options opts_;
+
+    std::mutex mx_;
+    std::condition_variable wake_;
+    std::condition_variable synced_;
+    std::vector<changeset> queue_;
+    std::uint64_t appended_{0};
+    std::uint64_t synced_count_{0};
+    /// Threads waiting in flush()
+    int flushing_{0};
+    bool stop_{false};
+    bool failed_{false};
+    std::string error_;
+    std::thread writer_;
+};
+
+} // namespace sketchy
@@ -18,12 +18,54 @@
 #include <doctest/doctest.h>
 
 #include <qapplication.h>
+#include <qbuffer.h>
+#include <qfile.h>
+#include <qimage.h>
+#include <qpainter.h>
+#include <qtemporarydir.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <thread>
 #include <vector>
 
+#include "document.hpp"
+#include "eraser.hpp"
+#include "journal.hpp"
+#include "lod.hpp"
+#include "memory_stats.hpp"
+#include "metrics.hpp"
+#include "outline.hpp"
+#include "png_writer.hpp"
+#include "predictor.hpp"
+#include "simplify.hpp"
 #include "storage.hpp"
+#include "stroke_codec.hpp"
+#include "svg_export.hpp"
+#include "tile_store.hpp"
+#include "ui/item_arena.hpp"
+#include "ui/loader.hpp"
+#include "ui/paint.hpp"
+#include "wal.hpp"
 
 using namespace sketchy;
 
+namespace {
+/// Stroke through pts with a weight of 1 at each, for fixtures
+auto make_stroke(stroke_id id, std::initializer_list<QPointF> pts)
+    -> stored_stroke
+{
+    detail::stroke s{QColor{"#1b1b1b"}};
+    for (const auto& p : pts) {
+        s.append(detail::stroke::point{p, 1});
+    }
+    return {id, s};
+}
+} // namespace
+
 TEST_CASE("serialization and deserialization works")
 {
     detail::stroke::line l{.start = {0.2, 0.5},
@@ -39,10 +81,798 @@ TEST_CASE("serialization and deserialization works")
     REQUIRE(actual == strokes);
 }
 
+TEST_CASE("old per-segment documents are stitched into strokes")
+{
+    // Saved top-most first, so the segments come out in reverse
+    const std::string legacy = R"([
+        {"s": {"x": 1.0, "y": 1.0}, "e": {"x": 2.0, "y": 2.0}, "w": 1.0,
+         "c": "#000000"},
+        {"s": {"x": 0.0, "y": 0.0}, "e": {"x": 1.0, "y": 1.0}, "w": 2.0,
+         "c": "#000000"},
+        {"s": {"x": 5.0, "y": 5.0}, "e": {"x": 6.0, "y": 6.0}, "w": 1.0,
+         "c": "#ff0000"}
+    ])";
+    const auto actual = from_json(legacy);
+
+    REQUIRE(actual.size() == 2);
+    CHECK(actual.at(0).colour == QColor{"#ff0000"});
+    REQUIRE(actual.at(1).points.size() == 3);
+    CHECK(actual.at(1).points.front().pos == QPointF{0, 0});
+    CHECK(actual.at(1).points.back().pos == QPointF{2, 2});
+}
+
+TEST_CASE("binary documents round trip the same as json")
+{
+    std::vector<detail::stroke> strokes;
+    for (auto i = 0; i != 3; ++i) {
+        auto& s = strokes.emplace_back(i % 2 ? QColor{"#1b1b1b"}
+                                             : QColor{"#ff8000"});
+        for (auto p = 0; p != 10 + i; ++p) {
+            s.append(detail::stroke::point{{p * 0.5 + i, p * 0.25},
+                                           0.1f * static_cast<float>(p)});
+        }
+    }
+
+    const auto bin = to_binary(strokes);
+    REQUIRE(is_binary(bin));
+    CHECK_FALSE(is_binary(to_json(strokes)));
+
+    const auto actual = from_binary(bin);
+    REQUIRE(actual == from_json(to_json(strokes)));
+    REQUIRE(actual == strokes);
+
+    CHECK_THROWS_AS(from_binary(std::string_view{bin}.substr(0, 40)),
+                    bad_document);
+}
+
+TEST_CASE("binary documents with a corrupt header are rejected")
+{
+    detail::stroke s{QColor{"#1b1b1b"}};
+    s.append(detail::stroke::point{{0, 0}, 1});
+    s.append(detail::stroke::point{{1, 1}, 1});
+    const auto bin = to_binary(std::vector{s});
+
+    const auto patched = [&bin](std::size_t at, std::uint32_t v) {
+        auto out = bin;
+        std::memcpy(out.data() + at, &v, sizeof(v));
+        return out;
+    };
+    // Colour count, then stroke count, far past the end of the file
+    CHECK_THROWS_AS(from_binary(patched(12, 0xffffffff)), bad_document);
+    CHECK_THROWS_AS(from_binary(patched(16, 0x7fffffff)), bad_document);
+    CHECK_THROWS_AS(from_binary(patched(16, 2)), bad_document);
+    // Point count
+    CHECK_THROWS_AS(from_binary(patched(24, 1000)), bad_document);
+    for (std::size_t n = 8; n < bin.size(); n += 4) {
+        CHECK_THROWS_AS(from_binary(std::string_view{bin}.substr(0, n)),
+                        bad_document);
+    }
+}
+
+TEST_CASE("journal replays changesets and drops a torn tail")
+{
+    const auto s0 = make_stroke(0, {{0, 0}, {1, 0}});
+    const auto s1 = make_stroke(1, {{0, 1}, {1, 1}});
+    const auto s2 = make_stroke(2, {{0, 2}, {1, 2}});
+    const auto s3 = make_stroke(3, {{0, 3}, {1, 3}});
+    QTemporaryDir dir;
+    const auto path = dir.filePath("doc.sketchy");
+
+    journal j{path};
+    std::vector<int> progress;
+    j.compact({s0, s1},
+              [&progress](int percent) { progress.push_back(percent); });
+    CHECK(std::is_sorted(progress.begin(), progress.end()));
+    CHECK(progress.back() == 100);
+    j.append({.added = {s2}, .erased = {0}});
+    const auto intact = j.size();
+    j.append({.added = {s3}, .erased = {}});
+
+    REQUIRE(journal{path}.load() == std::vector<stored_stroke>{s1, s2, s3});
+
+    QFile f{path};
+    f.open(QFile::ReadWrite);
+    f.resize(f.size() - 4);
+    f.close();
+
+    journal reopened{path};
+    REQUIRE(reopened.load() == std::vector<stored_stroke>{s1, s2});
+    CHECK(reopened.size() == intact);
+}
+
+TEST_CASE("write-ahead log reads back what was synced until closed")
+{
+    const auto s0 = make_stroke(0, {{0, 0}});
+    const auto s1 = make_stroke(1, {{1, 0}});
+    const auto s2 = make_stroke(2, {{2, 0}});
+    QTemporaryDir dir;
+    const auto doc = dir.filePath("doc.sketchy");
+    const auto path = wal::sidecar(doc);
+    const auto torn = dir.filePath("torn.wal");
+    {
+        wal log{path, doc, {.added = {s0}, .erased = {}}};
+        log.append({.added = {s1}, .erased = {}});
+        log.append({.added = {s2}, .erased = {0}});
+        log.flush();
+        CHECK(log.take_error().empty());
+
+        const auto w = wal::read(path);
+        REQUIRE(w);
+        CHECK(w->base == doc);
+        REQUIRE(w->changes.size() == 3);
+        CHECK(w->changes[0].added == std::vector<stored_stroke>{s0});
+        CHECK(w->changes[2].added == std::vector<stored_stroke>{s2});
+        CHECK(w->changes[2].erased == std::vector<stroke_id>{0});
+
+        REQUIRE(QFile::copy(path, torn));
+    }
+    CHECK_FALSE(QFile::exists(path));
+    CHECK_FALSE(wal::read(path));
+
+    QFile f{torn};
+    f.open(QFile::ReadWrite);
+    f.resize(f.size() - 4);
+    f.close();
+    CHECK(wal::read(torn)->changes.size() == 2);
+}
+
+TEST_CASE("notebook tiles can be written back independently")
+{
+    QTemporaryDir dir;
+    const auto path = dir.filePath("doc.sknb");
+    const auto far = tile_store::default_tile_size * 3;
+    const auto near = [](stroke_id id) {
+        return make_stroke(id, {{10, 0}, {11, 1}});
+    };
+    const auto s1 = make_stroke(1, {{far, 0}, {far + 1, 1}});
+    const auto s5 = make_stroke(5, {{far, 0}, {far + 1, 1}});
+
+    tile_store::create(path,
+                       {near(0), s1, make_stroke(2, {{-10, 0}, {-9, 1}})});
+    {
+        tile_store store{path};
+        REQUIRE(store.index().size() == 3);
+        CHECK(store.next_id() == 3);
+        const auto t = tile_of(s1.data, store.tile_size());
+        REQUIRE(store.load(t) == std::vector<stored_stroke>{s1});
+
+        store.store(t, {s1, s5});
+        store.store(tile_coord{-1, 0}, {});
+        store.flush();
+    }
+    tile_store store{path};
+    CHECK(store.index().size() == 2);
+    CHECK(store.next_id() == 6);
+    CHECK(store.load(tile_coord{0, 0}) ==
+          std::vector<stored_stroke>{near(0)});
+    CHECK(store.load(tile_coord{3, 0}).size() == 2);
+
+    store.store(tile_coord{0, 0}, {near(7)});
+    store.flush();
+    // Written after the index the header points at, so nothing is lost if
+    // it is never flushed
+    store.store(tile_coord{0, 0}, {near(8)});
+    CHECK(tile_store{path}.load(tile_coord{0, 0}) ==
+          std::vector<stored_stroke>{near(7)});
+
+    // Rewriting a tile over and over does not grow the file without bound
+    std::mt19937 rng{1};
+    // Whole units, which the codec keeps exactly
+    std::uniform_int_distribution<int> pos{0, 2000};
+    std::vector<stored_stroke> big;
+    for (stroke_id id = 10; id != 2010; ++id) {
+        detail::stroke s{QColor{"#1b1b1b"}};
+        for (auto p = 0; p != 50; ++p) {
+            const QPointF at{static_cast<double>(pos(rng)),
+                             static_cast<double>(pos(rng))};
+            s.append(detail::stroke::point{at, 1});
+        }
+        big.push_back({id, s});
+    }
+    for (auto i = 0; i != 40; ++i) {
+        store.store(tile_coord{0, 0}, big);
+        store.flush();
+    }
+    const auto fresh = dir.filePath("fresh.sknb");
+    std::vector<stored_stroke> all = big;
+    all.push_back(s1);
+    all.push_back(s5);
+    tile_store::create(fresh, all);
+    CHECK(QFile{path}.size() <= 2 * QFile{fresh}.size() + 4 * 1024 * 1024);
+    CHECK(tile_store{path}.load(tile_coord{0, 0}) == big);
+    CHECK(store.load(tile_coord{0, 0}) == big);
+
+    // A slow writer finishing after a newer store of the tile is dropped
+    store.store(tile_coord{0, 0}, {near(9)}, 5);
+    store.store(tile_coord{0, 0}, big, 3);
+    CHECK(store.load(tile_coord{0, 0}) == std::vector<stored_stroke>{near(9)});
+}
+
+TEST_CASE("stroke codec is within its resolution and much smaller")
+{
+    std::vector<detail::stroke> strokes;
+    for (auto i = 0; i != 20; ++i) {
+        auto& s = strokes.emplace_back(QColor{"#1b1b1b"});
+        for (auto p = 0; p != 200; ++p) {
+            const auto t = p * 0.1;
+            const QPointF pos{i * 40 + t * 3 + std::sin(t) * 7.3,
+                              i * 11 + std::cos(t) * 5.1};
+            s.append(detail::stroke::point{
+                pos, static_cast<float>(4 + std::sin(t * 0.7) * 3)});
+        }
+    }
+    const codec_options opts;
+    const auto encoded = encode_strokes(strokes, opts);
+    const auto decoded = decode_strokes(encoded);
+
+    REQUIRE(decoded.size() == strokes.size());
+    for (std::size_t i = 0; i != strokes.size(); ++i) {
+        const auto& expected = strokes[i].points;
+        const auto& actual = decoded[i].points;
+        REQUIRE(actual.size() == expected.size());
+        CHECK(decoded[i].colour == strokes[i].colour);
+        for (std::size_t p = 0; p != expected.size(); ++p) {
+            CHECK(std::abs(actual[p].pos.x() - expected[p].pos.x()) <=
+                  opts.resolution / 2);
+            CHECK(std::abs(actual[p].pos.y() - expected[p].pos.y()) <=
+                  opts.resolution / 2);
+            CHECK(std::abs(actual[p].weight - expected[p].weight) <= 0.01);
+        }
+    }
+    CHECK(encoded.size() * 10 <= to_json(strokes).size());
+}
+
+TEST_CASE("document query finds the same strokes as a scan of every one")
+{
+    std::mt19937 rng{7};
+    std::uniform_real_distribution<double> pos{-5000, 5000};
+    std::uniform_real_distribution<double> len{0, 400};
+    const auto make = [&](bool huge) {
+        detail::stroke s;
+        const auto x = pos(rng);
+        const auto y = pos(rng);
+        const auto l = huge ? 8000 : len(rng);
+        for (auto p = 0; p != 4; ++p) {
+            s.append(detail::stroke::point{{x + l * p / 3, y + l * p / 6}, 2});
+        }
+        return s;
+    };
+    std::vector<stroke_id> ids(3000);
+    std::iota(ids.begin(), ids.end(), stroke_id{0});
+    std::shuffle(ids.begin(), ids.end(), rng);
+    document doc;
+    std::vector<stored_stroke> batch;
+    for (const auto id : ids) {
+        batch.push_back({id, make(id % 100 == 0)});
+        if (batch.size() == 500) {
+            doc.add(batch);
+            batch.clear();
+        }
+    }
+    std::vector<stroke_id> gone;
+    for (auto i = 0; i != 1000; ++i) {
+        gone.push_back(rng() % ids.size());
+    }
+    doc.remove(gone);
+
+    std::vector<std::size_t> hit;
+    for (auto i = 0; i != 100; ++i) {
+        const auto size = len(rng) * 5;
+        const QRectF area{pos(rng), pos(rng), size, size};
+        std::vector<std::size_t> expected;
+        for (std::size_t s = 0; s != doc.size(); ++s) {
+            if (doc.view(s).bounds.intersects(area)) {
+                expected.push_back(s);
+            }
+        }
+        doc.query(area, hit);
+        REQUIRE(hit == expected);
+    }
+    doc.query(QRectF{-1e9, -1e9, 2e9, 2e9}, hit);
+    CHECK(hit.size() == doc.size());
+}
+
+TEST_CASE("document keeps id order, precision and unaffected copies")
+{
+    const auto line = [](double y, QColor c) {
+        detail::stroke s{c};
+        s.append(detail::stroke::point{{0, y}, 1});
+        s.append(detail::stroke::point{{10, y}, 2});
+        return s;
+    };
+    document doc;
+    doc.add(5, line(5, Qt::red));
+    doc.add({{2, line(2, Qt::black)}, {9, line(9, Qt::red)}});
+    REQUIRE(doc.size() == 3);
+    CHECK(doc.id(0) == 2);
+    CHECK(doc.id(2) == 9);
+    CHECK(doc.points() == 6);
+    CHECK(doc.get(5).to_stroke() == line(5, Qt::red));
+    CHECK(doc.bounds() == QRectF{QPointF{-1, 1}, QPointF{11, 10}});
+
+    std::vector<std::size_t> hit;
+    doc.query(QRectF{-5, 4, 20, 2}, hit);
+    CHECK(hit == std::vector<std::size_t>{1});
+
+    const auto snapshot = doc;
+    const std::vector<stroke_id> gone{5, 42};
+    doc.remove(gone);
+    doc.add(7, line(7, Qt::blue));
+    CHECK_FALSE(doc.contains(5));
+    CHECK(doc.id(1) == 7);
+    CHECK(snapshot.size() == 3);
+    CHECK(snapshot.get(5).to_stroke() == line(5, Qt::red));
+
+    // Stored relative to its chunk, so nothing is lost far from the origin
+    detail::stroke far;
+    far.append(detail::stroke::point{{1e9 + 0.125, -3e9 + 0.5}, 1});
+    doc.add(11, far);
+    CHECK(doc.get(11).point(0) == far.points.front());
+    CHECK(std::abs(doc.get(11).xs[0]) < chunk_size);
+    CHECK(from_binary_stored(to_binary(snapshot)) == snapshot.stored());
+    CHECK_THROWS_AS(doc.get(5), std::out_of_range);
+
+    // Batches in any order are merged in, as a streamed load adds them
+    document merged;
+    std::vector<stroke_id> ids(200);
+    std::iota(ids.begin(), ids.end(), stroke_id{0});
+    std::shuffle(ids.begin(), ids.end(), std::mt19937_64{7});
+    for (std::size_t i = 0; i < ids.size(); i += 30) {
+        std::vector<stored_stroke> batch;
+        for (auto j = i; j != std::min(i + 30, ids.size()); ++j) {
+            batch.push_back({ids[j], line(static_cast<double>(ids[j]),
+                                          Qt::black)});
+        }
+        merged.add(batch);
+    }
+    REQUIRE(merged.size() == ids.size());
+    for (std::size_t i = 0; i != merged.size(); ++i) {
+        CHECK(merged.id(i) == i);
+        CHECK(merged.view(i).bounds.center().y() == static_cast<double>(i));
+    }
+}
+
+TEST_CASE("eraser cuts strokes at the edge of the circle")
+{
+    detail::stroke s{QColor{"#1b1b1b"}};
+    for (auto i = 0; i <= 100; ++i) {
+        s.append(detail::stroke::point{{static_cast<double>(i), 0}, 2});
+    }
+    document doc;
+    doc.add(1, s);
+    const auto view = doc.get(1);
+    segment_grid grid{16};
+    grid.insert(view);
+
+    const auto spans = grid.query(QRectF{QPointF{45, -5}, QPointF{55, 5}});
+    REQUIRE(spans.size() == 1);
+
+    CHECK_FALSE(erase_circle(view, spans.front(), {50, 20}, 4, true));
+    const auto whole = erase_circle(view, spans.front(), {50, 0}, 4, false);
+    REQUIRE(whole);
+    CHECK(whole->empty());
+
+    // Radius 4 plus half the width of the line
+    const auto pieces = erase_circle(view, spans.front(), {50, 0}, 4, true);
+    REQUIRE(pieces);
+    REQUIRE(pieces->size() == 2);
+    CHECK(pieces->at(0).points.front().pos == QPointF{0, 0});
+    CHECK(pieces->at(0).points.back().pos.x() == doctest::Approx(45));
+    CHECK(pieces->at(1).points.front().pos.x() == doctest::Approx(55));
+    CHECK(pieces->at(1).points.back().pos == QPointF{100, 0});
+
+    grid.remove(view);
+    CHECK(grid.query(QRectF{QPointF{0, -5}, QPointF{100, 5}}).empty());
+}
+
+TEST_CASE("pieces cut from a stroke keep its place in the stacking order")
+{
+    document doc;
+    doc.add({make_stroke(0, {{0, 0}, {50, 0}, {100, 0}}),
+             make_stroke(1, {{50, -50}, {50, 50}})});
+    const auto view = doc.get(0);
+    segment_grid grid{16};
+    grid.insert(view);
+    const auto spans = grid.query(QRectF{QPointF{20, -5}, QPointF{30, 5}});
+    REQUIRE(spans.size() == 1);
+    auto pieces = erase_circle(view, spans.front(), {25, 0}, 4, true);
+    REQUIRE(pieces);
+    REQUIRE(pieces->size() == 2);
+
+    // Added the way the canvas does, with new ids in the place of stroke 0
+    const auto order = view.order;
+    const std::vector<stroke_id> gone{0};
+    doc.remove(gone);
+    doc.add(2, pieces->at(0), order);
+    doc.add(3, pieces->at(1), order);
+    const auto stacking = [](const document& d) {
+        std::vector<stroke_id> ids;
+        for (std::size_t i = 0; i != d.size(); ++i) {
+            ids.push_back(d.id(i));
+        }
+        return ids;
+    };
+    CHECK(stacking(doc) == std::vector<stroke_id>{2, 3, 1});
+    std::vector<std::size_t> hits;
+    doc.query(QRectF{QPointF{40, -5}, QPointF{60, 5}}, hits);
+    REQUIRE(hits.size() == 2);
+    CHECK(doc.id(hits[0]) == 3);
+    CHECK(doc.id(hits[1]) == 1);
+
+    // Cutting a piece again keeps the original place
+    doc.remove(std::vector<stroke_id>{2});
+    doc.add(4, pieces->at(0), doc.get(3).order);
+    CHECK(stacking(doc) == std::vector<stroke_id>{3, 4, 1});
+
+    // Saved and loaded back in any order, the place goes with them
+    const auto stored = doc.stored();
+    CHECK(stored.front().cut_from == stroke_id{0});
+    CHECK_FALSE(stored.back().cut_from);
+    CHECK(from_binary_stored(to_binary(doc)) == stored);
+    const auto decoded = decode_stored_strokes(encode_strokes(stored));
+    REQUIRE(decoded.size() == stored.size());
+    CHECK(decoded.front().cut_from == stroke_id{0});
+    document loaded;
+    loaded.add(std::vector<stored_stroke>(stored.rbegin(), stored.rend()));
+    CHECK(stacking(loaded) == std::vector<stroke_id>{3, 4, 1});
+}
+
+TEST_CASE("simplify keeps corners and pressure changes within tolerance")
+{
+    detail::stroke s;
+    for (auto i = 0; i <= 100; ++i) {
+        s.append(detail::stroke::point{{i * 0.1, 0.01 * (i % 2)}, 1.f});
+    }
+    for (auto i = 1; i <= 100; ++i) {
+        s.append(detail::stroke::point{{10, i * 0.1},
+                                       1.f + (i > 50 ? 2.f : 0.f)});
+    }
+
+    const auto actual = simplify(s, 0.25);
+    REQUIRE(actual.points.size() == 5);
+    CHECK(actual.points.front() == s.points.front());
+    CHECK(actual.points.at(1).pos == QPointF{10, 0});
+    CHECK(actual.points.back() == s.points.back());
+    CHECK(simplify(s, 0).points.size() == s.points.size());
+}
+
+TEST_CASE("prediction follows the pen and counts the latency it hides")
+{
+    pen_predictor p;
+    std::vector<detail::stroke::point> tail;
+    // Round a circle at a steady pace, a sample every 4ms
+    for (auto i = 0; i != 100; ++i) {
+        const auto t = i * 4.0;
+        const auto a = t * 0.01;
+        p.add(t, {{100 * std::cos(a), 100 * std::sin(a)}, 2});
+        p.predict(predict_horizon_ms, tail);
+    }
+    REQUIRE(tail.size() == 3);
+    const auto a = (396 + predict_horizon_ms) * 0.01;
+    const auto miss = tail.back().pos - QPointF{100 * std::cos(a),
+                                                100 * std::sin(a)};
+    CHECK(std::hypot(miss.x(), miss.y()) < 1);
+    CHECK(p.stats().checked > 90);
+    CHECK(p.stats().hits == p.stats().checked);
+    CHECK(p.stats().hidden_latency_ms() == doctest::Approx(predict_horizon_ms));
+
+    // A pen held still is not predicted anywhere
+    p.reset();
+    for (auto i = 0; i != 5; ++i) {
+        p.add(i * 4.0, {{1, 1}, 2});
+    }
+    p.predict(predict_horizon_ms, tail);
+    CHECK(tail.empty());
+}
+
+TEST_CASE("loading hands over strokes near the view first")
+{
+    std::vector<stored_stroke> doc{make_stroke(0, {{500, 0}, {501, 0}}),
+                                   make_stroke(1, {{5, 0}, {6, 0}}),
+                                   make_stroke(2, {{100, 0}, {101, 0}}),
+                                   make_stroke(3, {{8, 0}, {9, 0}}),
+                                   make_stroke(4, {{-50, 0}, {-49, 0}})};
+
+    const auto meeting =
+        ui::detail::nearest_first(doc, QRectF{0, -10, 20, 20});
+    REQUIRE(meeting == 2);
+    std::vector<stroke_id> order;
+    for (const auto& s : doc) {
+        order.push_back(s.id);
+    }
+    CHECK(order == std::vector<stroke_id>{1, 3, 4, 2, 0});
+}
+
+TEST_CASE("loading decodes a journal a stroke at a time")
+{
+    QTemporaryDir dir;
+    const auto path = dir.filePath("doc.sketchy");
+    journal j{path};
+    j.compact({make_stroke(0, {{500, 0}, {501, 0}}),
+               make_stroke(1, {{5, 0}, {6, 0}}),
+               make_stroke(2, {{100, 0}, {101, 0}}),
+               make_stroke(3, {{300, 0}, {301, 0}})});
+    j.append({.added = {make_stroke(4, {{8, 0}, {9, 0}})}, .erased = {2}});
+    j.append({.added = {}, .erased = {4}});
+
+    QFile f{path};
+    REQUIRE(f.open(QFile::ReadOnly));
+    const auto data = f.readAll();
+    journal reopened{path};
+    auto r = reopened.read({data.constData(),
+                            static_cast<std::size_t>(data.size())});
+    CHECK(reopened.size() == static_cast<std::uint64_t>(data.size()));
+    CHECK(r.next_id() == 5);
+    std::vector<stroke_id> ids;
+    while (auto s = r.next()) {
+        ids.push_back(s->id);
+    }
+    CHECK(ids == std::vector<stroke_id>{0, 1, 3});
+
+    auto loading = ui::load_document(path, QRectF{0, -10, 20, 20});
+    loading.waitForFinished();
+    const auto batches = loading.results();
+    REQUIRE_FALSE(batches.empty());
+    CHECK(batches.front().source);
+    std::vector<stroke_id> order;
+    for (const auto& b : batches) {
+        CHECK(b.next_id == 5);
+        for (const auto& s : b.strokes) {
+            order.push_back(s.id);
+        }
+    }
+    CHECK(order == std::vector<stroke_id>{1, 3, 0});
+}
+
+TEST_CASE("item arena keeps a reserved batch together and reuses slots")
+{
+    struct item {
+        explicit item(int v) : v{v} {}
+        int v;
+    };
+    ui::item_arena<item> arena;
+    arena.reserve(3);
+    auto* a = arena.make(1);
+    auto* b = arena.make(2);
+    auto* c = arena.make(3);
+    CHECK(b == a + 1);
+    CHECK(c == b + 1);
+    CHECK(arena.size() == 3);
+
+    arena.destroy(b);
+    CHECK(arena.make(4) == b);
+    CHECK(b->v == 4);
+    arena.destroy(a);
+    arena.destroy(b);
+    arena.destroy(c);
+    CHECK(arena.size() == 0);
+    arena.reset();
+    CHECK(arena.capacity() == 0);
+}
+
+TEST_CASE("outline painting keeps the stacking order across colours")
+{
+    const auto line = [](QPointF from, QPointF to, QColor c) {
+        detail::stroke s{c};
+        s.append(detail::stroke::point{from, 4});
+        s.append(detail::stroke::point{(from + to) / 2, 4});
+        s.append(detail::stroke::point{to, 4});
+        return s;
+    };
+    document doc;
+    doc.add(0, line({0, 10}, {30, 10}, Qt::red));
+    doc.add(1, line({10, 0}, {10, 30}, Qt::blue));
+    doc.add(2, line({0, 20}, {30, 20}, Qt::red));
+
+    QImage img{30, 30, QImage::Format_RGB32};
+    img.fill(Qt::white);
+    QPainter p{&img};
+    ui::outline_painter painter{p};
+    for (std::size_t i = 0; i != doc.size(); ++i) {
+        painter.paint(doc.view(i));
+    }
+    p.end();
+
+    CHECK(img.pixelColor(10, 10) == QColor{Qt::blue});
+    CHECK(img.pixelColor(10, 20) == QColor{Qt::red});
+    CHECK(img.pixelColor(25, 10) == QColor{Qt::red});
+    CHECK(img.pixelColor(25, 25) == QColor{Qt::white});
+}
+
+TEST_CASE("outlines follow the weight and only the end is redone")
+{
+    detail::stroke s;
+    s.append(detail::stroke::point{{0, 0}, 2});
+    s.append(detail::stroke::point{{10, 0}, 6});
+    document doc;
+    doc.add(0, s);
+    QPolygonF out;
+    stroke_outline(doc.view(0), out);
+    CHECK(out.boundingRect() == QRectF{QPointF{-1, -3}, QPointF{13, 3}});
+
+    // A zig-zag with sharp turns stays inside the stroke's bounds
+    detail::stroke zig;
+    outline_builder live;
+    QPolygonF grown;
+    for (auto i = 0; i != 20; ++i) {
+        const detail::stroke::point pt{{i * 3.0, (i % 2) * 10.0},
+                                       1.0F + static_cast<float>(i % 3)};
+        zig.append(pt);
+        live.add(pt.pos, pt.weight);
+        live.build(grown);
+    }
+    outline_builder whole;
+    for (const auto& pt : zig.points) {
+        whole.add(pt.pos, pt.weight);
+    }
+    whole.build(out);
+    CHECK(grown == out);
+    const auto b = out.boundingRect();
+    const auto z = zig.bounds();
+    CHECK(b.left() >= z.left() - 1e-9);
+    CHECK(b.right() <= z.right() + 1e-9);
+    CHECK(b.top() >= z.top() - 1e-9);
+    CHECK(b.bottom() <= z.bottom() + 1e-9);
+}
+
+TEST_CASE("levels of detail coarsen with the zoom and stay in bounds")
+{
+    CHECK(lod_level(1) == -1);
+    CHECK(lod_level(0.5) == 0);
+    CHECK(lod_level(0.25) == 1);
+    CHECK(lod_level(1e-12) == static_cast<int>(lod_max_levels) - 1);
+
+    detail::stroke wave;
+    for (auto i = 0; i != 400; ++i) {
+        wave.append(detail::stroke::point{
+            {i * 1.0, 40 * std::sin(i / 10.0)}, 2.0F + (i % 3)});
+    }
+    document doc;
+    doc.add(0, wave);
+    doc.add(1, simplify(wave, 1e9));
+    stroke_lod lod;
+    lod.build(doc.view(0));
+    REQUIRE(lod.levels() > 2);
+    const auto z = doc.view(0).bounds;
+    for (std::size_t i = 0; i != lod.levels(); ++i) {
+        if (i != 0) {
+            CHECK(lod.outline(i).size() <= lod.outline(i - 1).size());
+        }
+        const auto b = lod.outline(i).boundingRect();
+        CHECK(z.adjusted(-1e-9, -1e-9, 1e-9, 1e-9).contains(b));
+    }
+    CHECK(lod.outline(lod.levels() - 1).size() < wave.points.size());
+    CHECK(&lod.outline(100) == &lod.outline(lod.levels() - 1));
+
+    lod.build(doc.view(1));
+    CHECK(lod.levels() == 0);
+}
+
+TEST_CASE("memory stats break the document down per segment")
+{
+    document doc;
+    for (auto i = 0; i != 10; ++i) {
+        detail::stroke s;
+        for (auto j = 0; j != 101; ++j) {
+            s.append(detail::stroke::point{{j * 1.0, i * 10.0}, 2});
+        }
+        doc.add(static_cast<stroke_id>(i), s);
+    }
+    const std::vector<stroke_id> gone{0};
+    doc.remove(gone);
+    const auto parts = doc.memory_parts();
+    CHECK(parts.points >= 1010 * 3 * sizeof(float));
+    CHECK(parts.removed_points == 101 * 3 * sizeof(float));
+    CHECK(doc.memory_usage() == parts.points + parts.strokes + parts.palette);
+
+    memory_stats m;
+    m.strokes = doc.size();
+    m.points = doc.points();
+    m.point_bytes = parts.points;
+    m.stroke_bytes = parts.strokes;
+    m.item_bytes = 9000;
+    CHECK(m.segments() == 900);
+    CHECK(m.total_bytes() == parts.points + parts.strokes + 9000);
+    const auto json = to_json(m);
+    CHECK(json.front() == '{');
+    CHECK(json.back() == '}');
+    CHECK(json.find(R"("segments":900)") != std::string::npos);
+    CHECK(json.find(R"("items":{"bytes":9000,"per_segment":10.00,)"
+                    R"("per_1k_points":9901.0})") != std::string::npos);
+}
+
+TEST_CASE("latency histograms keep percentiles within a bucket")
+{
+    const auto last = histogram::bucket_of(histogram::max_us);
+    for (std::size_t b = 0; b != last; ++b) {
+        CHECK(histogram::bucket_of(histogram::bucket_top(b)) == b);
+        CHECK(histogram::bucket_of(histogram::bucket_top(b) + 1) == b + 1);
+    }
+
+    histogram h;
+    CHECK(h.percentile(0.5) == 0);
+    for (std::uint64_t us = 1; us <= 1000; ++us) {
+        h.record(us);
+    }
+    CHECK(h.count() == 1000);
+    CHECK(h.mean() == doctest::Approx(500.5));
+    CHECK(h.percentile(0.5) >= 500);
+    CHECK(h.percentile(0.5) <= 500 * 1.04);
+    CHECK(h.percentile(0.99) >= 990);
+    CHECK(h.percentile(1) == 1000);
+    h.record(~std::uint64_t{0});
+    CHECK(h.max() == histogram::max_us);
+
+    // Recorded from several threads at once without a lock
+    histogram shared;
+    std::vector<std::thread> threads;
+    for (auto t = 0; t != 4; ++t) {
+        threads.emplace_back([&shared] {
+            for (std::uint64_t i = 0; i != 10000; ++i) {
+                shared.record(i % 100);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    CHECK(shared.count() == 40000);
+    CHECK(shared.max() == 99);
+}
+
+TEST_CASE("svg export merges paths and crops to the ink")
+{
+    document doc;
+    for (auto i = 0; i != 3; ++i) {
+        detail::stroke s{QColor{"#1b1b1b"}};
+        s.append(detail::stroke::point{{100, 100.0 + i}, 2});
+        s.append(detail::stroke::point{{110, 100.0 + i}, 2});
+        doc.add(static_cast<stroke_id>(i), s);
+    }
+
+    QBuffer buf;
+    buf.open(QBuffer::WriteOnly);
+    write_svg(buf, doc);
+    const auto svg = buf.data().toStdString();
+
+    CHECK(svg.find(R"(viewBox="0 0 12 4")") != std::string::npos);
+    const auto first = svg.find("<path");
+    REQUIRE(first != std::string::npos);
+    CHECK(svg.find("<path", first + 1) == std::string::npos);
+    CHECK(svg.find(R"(d="M1 1l10 0 M1 2l10 0 M1 3l10 0")") !=
+          std::string::npos);
+}
+
+TEST_CASE("png writer streams rows Qt can read back")
+{
+    constexpr std::uint32_t w = 37;
+    constexpr std::uint32_t h = 11;
+    QBuffer buf;
+    buf.open(QBuffer::WriteOnly);
+    {
+        png_writer png{buf, w, h, 300};
+        std::vector<std::uint8_t> row(w * 3);
+        for (std::uint32_t y = 0; y != h; ++y) {
+            for (std::uint32_t x = 0; x != w; ++x) {
+                row[x * 3] = static_cast<std::uint8_t>(x * 6);
+                row[x * 3 + 1] = static_cast<std::uint8_t>(y * 20);
+                row[x * 3 + 2] = 77;
+            }
+            png.write_row(row.data());
+        }
+        png.finish();
+    }
+
+    const auto img = QImage::fromData(buf.data(), "PNG");
+    REQUIRE(img.size() == QSize{w, h});
+    CHECK(img.pixel(5, 3) == qRgb(30, 60, 77));
+    CHECK(img.dotsPerMeterX() == 11811);
+}
+
 int main(int argc, char** argv)
 {
     QApplication app{argc, argv};
     doctest::Context ctx;
     ctx.applyCommandLine(argc, argv);
     return ctx.run();
-}
\ No newline at end of file
+}